@@ -1,4 +1,5 @@
 ﻿#include <iostream>
+#include <memory>
 #include <chrono>
 #include <SDL.h>
 #include <thread>
@@ -8,6 +9,7 @@
 #include "PressWorld.h"
 #include "PressVelWorld.h"
 #include "PressVelWorldThreaded.h"
+#include "WorldRenderer.h"
 
 // Benchmark
 constexpr int g_NumSteps = 4000;
@@ -19,92 +21,13 @@ constexpr int g_WindowHeight = 500;
 
 // Rendering
 SDL_Renderer* g_pRenderer = nullptr;
+std::unique_ptr<WorldRenderer> g_pWorldRenderer;
 constexpr bool g_Render = true;
 
-// Render
-void RenderWorld(const World& world)
-{
-	const float cellWidth = static_cast<float>(g_WindowWidth) / static_cast<float>(world.GetSize().x);
-	const float cellHeight = static_cast<float>(g_WindowHeight) / static_cast<float>(world.GetSize().y);
-
-	const auto& pressures = world.GetWaterPressures();
-
-	for (int x = 0; x < world.GetSize().x; ++x)
-	{
-		for (int y = 0; y < world.GetSize().y; ++y)
-		{
-			if (pressures[x][y] < 0.001f)
-				continue;
-
-			if (pressures[x][y] <= 1)
-			{
-				if (y + 1 < world.GetSize().y &&
-					pressures[x][y+1] >= 0.001f)
-				{
-					SDL_FRect rect = {
-					x * cellWidth,
-					g_WindowHeight - (y + 1) * cellHeight,
-					cellWidth,
-					cellHeight
-					};
-
-					SDL_SetRenderDrawColor(g_pRenderer, 255 / (pressures[x][y] + 1), 255 / (pressures[x][y] + 1), 255, 255);
-					SDL_RenderFillRectF(g_pRenderer, &rect);
-				}
-				else
-				{
-					SDL_FRect rect{
-						x * cellWidth,
-						g_WindowHeight - (y + pressures[x][y]) * cellHeight,
-						cellWidth,
-						pressures[x][y] * cellHeight
-					};
-
-					SDL_SetRenderDrawColor(g_pRenderer, 255 / 2, 255 / 2, 255, 255);
-					SDL_RenderFillRectF(g_pRenderer, &rect);
-				}
-			}
-			else
-			{
-				SDL_FRect rect = {
-					x * cellWidth,
-					g_WindowHeight - (y + 1) * cellHeight,
-					cellWidth,
-					cellHeight
-				};
-
-				SDL_SetRenderDrawColor(g_pRenderer, 255 / (pressures[x][y] + 1), 255 / (pressures[x][y] + 1), 255, 255);
-				SDL_RenderFillRectF(g_pRenderer, &rect);
-			}
-		}
-	}
-
-	const auto& boundaries = world.GetBoundaries();
-
-	for (int x = 0; x < world.GetSize().x; ++x)
-	{
-		for (int y = 0; y < world.GetSize().y; ++y)
-		{
-			if (!boundaries[x][y])
-				continue;
-
-			SDL_FRect rect{
-				x * cellWidth,
-				g_WindowHeight - (y + 1) * cellHeight,
-				cellWidth,
-				cellHeight
-			};
-
-			SDL_SetRenderDrawColor(g_pRenderer, 0, 0, 0, 255);
-			SDL_RenderFillRectF(g_pRenderer, &rect);
-		}
-	}
-}
-
 int main()
 {
     // Init SDL
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
         std::cout << "error initializing SDL:" << SDL_GetError() << std::endl;
 
     // Create window and renderer
@@ -116,7 +39,8 @@ int main()
 			g_WindowWidth, g_WindowHeight, 
 			0);
 
-		g_pRenderer = SDL_CreateRenderer(pWindow, -1, SDL_RENDERER_ACCELERATED);
+		g_pRenderer = WorldRenderer::CreateRenderer(pWindow);
+		g_pWorldRenderer = std::make_unique<WorldRenderer>(g_pRenderer, glm::ivec2{ g_WindowWidth, g_WindowHeight });
 	}
 
 	std::cout << "size,time" << std::endl;
@@ -154,23 +78,8 @@ int main()
 		}*/
 
 		// Left water with bottom hole
-		for (int x = 0; x < size; x++)
-		{
-			for (int y = 0; y < size; y++)
-			{
-				if (x < size / 2)
-				{
-					world.SetWater({ x, y }, true);
-				}
-				else if (x == size / 2)
-				{
-					if (y > 3)
-					{
-						world.SetBoundary({ x, y }, true);
-					}
-				}
-			}
-		}
+		world.FillWater({ 0, 0 }, { size / 2, size }, true);
+		world.FillBoundary({ size / 2, 4 }, { size / 2 + 1, size }, true);
 
 		// Loop
 		long long updateTime = 0;
@@ -183,11 +92,7 @@ int main()
 
 			if (g_Render)
 			{
-				SDL_SetRenderDrawColor(g_pRenderer, 255, 255, 255, 255);
-				SDL_RenderClear(g_pRenderer);
-
-				RenderWorld(world);
-
+				g_pWorldRenderer->Render(world);
 				SDL_RenderPresent(g_pRenderer);
 			}
 		}
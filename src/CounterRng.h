@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Stateless random numbers, a hash of the seed, the step, the cell and which draw for that cell
+// it is. The same inputs always give the same number, no matter which thread asks or in which
+// order the cells are visited, so serial, threaded and vectorized runs can agree exactly.
+
+[[nodiscard]] inline uint64_t MixBits(uint64_t value)
+{
+	// SplitMix64 finalizer
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+	return value ^ (value >> 31);
+}
+
+[[nodiscard]] inline uint32_t RandomBits(uint32_t seed, uint32_t step, const glm::ivec2& position, uint32_t draw = 0)
+{
+	const uint64_t key = static_cast<uint64_t>(seed) << 32 | step;
+	const uint64_t counter = static_cast<uint64_t>(static_cast<uint32_t>(position.x)) << 32 | static_cast<uint32_t>(position.y);
+
+	// Two rounds, so neighbouring cells and steps give unrelated numbers
+	const uint64_t hash = MixBits(MixBits(key + draw * 0x9E3779B97F4A7C15ull) ^ counter);
+	return static_cast<uint32_t>(hash >> 32);
+}
+
+// In [0, 1)
+[[nodiscard]] inline float RandomFloat(uint32_t seed, uint32_t step, const glm::ivec2& position, uint32_t draw = 0)
+{
+	return static_cast<float>(RandomBits(seed, step, position, draw) >> 8) * (1.f / 16777216.f);
+}
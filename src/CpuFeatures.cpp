@@ -0,0 +1,59 @@
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+	std::atomic<SimdLevel> g_MaxSimdLevel = SimdLevel::Avx2;
+
+	bool DetectAvx2()
+	{
+#if !defined(CPU_X86)
+		return false;
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+
+		// The OS has to save the AVX registers on context switches
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+}
+
+bool CpuSupportsAvx2()
+{
+	static const bool supported = DetectAvx2();
+	return supported;
+}
+
+SimdLevel GetSimdLevel()
+{
+#ifdef CPU_SSE2
+	const SimdLevel supported = CpuSupportsAvx2() ? SimdLevel::Avx2 : SimdLevel::Sse2;
+#else
+	const SimdLevel supported = CpuSupportsAvx2() ? SimdLevel::Avx2 : SimdLevel::Scalar;
+#endif
+	return std::min(supported, g_MaxSimdLevel.load(std::memory_order_relaxed));
+}
+
+void SetMaxSimdLevel(SimdLevel level)
+{
+	g_MaxSimdLevel.store(level, std::memory_order_relaxed);
+}
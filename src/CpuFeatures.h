@@ -0,0 +1,27 @@
+#pragma once
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define CPU_X86
+#endif
+
+// SSE2 can be used without a runtime check
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_SSE2
+#endif
+
+// True when the CPU and the OS support AVX2, checked once
+[[nodiscard]] bool CpuSupportsAvx2();
+
+// Instruction sets the kernels can be vectorized with, from least to most capable
+enum class SimdLevel
+{
+	Scalar,
+	Sse2,
+	Avx2
+};
+
+// The most capable level the CPU supports, at most the one given to SetMaxSimdLevel()
+[[nodiscard]] SimdLevel GetSimdLevel();
+// Worlds pick their kernels when they are created, so this only applies to the ones created
+// after. Meant for comparing the kernels against each other.
+void SetMaxSimdLevel(SimdLevel level);
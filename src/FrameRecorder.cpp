@@ -0,0 +1,322 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	constexpr char Magic[8] = { 'C', 'A', 'F', 'R', 'A', 'M', 'E', 'S' };
+	constexpr uint32_t Version = 1;
+
+	struct FileHeader
+	{
+		char Magic[8];
+		uint32_t Version;
+		int32_t Width;
+		int32_t Height;
+		float QuantizationScale;
+	};
+
+	uint16_t Quantize(float pressure)
+	{
+		const float scaled = std::round(pressure * FrameRecorder::QuantizationScale);
+		return static_cast<uint16_t>(std::clamp(scaled, 0.f, 65535.f));
+	}
+
+	uint32_t ZigZag(int32_t value)
+	{
+		return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+	}
+
+	int32_t UnZigZag(uint32_t value)
+	{
+		return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+	}
+
+	bool ReadVarint(const uint8_t*& pData, const uint8_t* pEnd, uint32_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 35 && pData < pEnd; shift += 7)
+		{
+			const uint8_t byte = *pData++;
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+}
+
+FrameRecorder::FrameRecorder(const glm::ivec2& size, int ringSize)
+	: m_Size(size)
+	, m_Ring(std::max(ringSize, 1), Grid2D<float>(size, 0))
+	, m_Previous(size, 0)
+{}
+
+FrameRecorder::~FrameRecorder()
+{
+	Stop();
+}
+
+bool FrameRecorder::Start(const std::string& path)
+{
+	Stop();
+
+	m_pFile = std::fopen(path.c_str(), "wb");
+	if (!m_pFile)
+		return false;
+
+	FileHeader header{};
+	std::memcpy(header.Magic, Magic, sizeof(Magic));
+	header.Version = Version;
+	header.Width = m_Size.x;
+	header.Height = m_Size.y;
+	header.QuantizationScale = QuantizationScale;
+
+	{
+		std::lock_guard lock(m_Mutex);
+		m_Stats = {};
+		m_Stats.WriteFailed = std::fwrite(&header, sizeof(header), 1, m_pFile) != 1;
+		m_Stats.BytesWritten = sizeof(header);
+		m_First = 0;
+		m_Queued = 0;
+		m_Stop = false;
+	}
+
+	// The first frame is stored against an empty world
+	m_Previous.Fill(0);
+	m_Writer = std::thread(&FrameRecorder::WriterLoop, this);
+	return true;
+}
+
+void FrameRecorder::Stop()
+{
+	if (!m_pFile)
+		return;
+
+	{
+		std::lock_guard lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_FrameQueuedCV.notify_one();
+	m_Writer.join();
+
+	if (std::fclose(m_pFile) != 0)
+		m_Stats.WriteFailed = true;
+	m_pFile = nullptr;
+}
+
+bool FrameRecorder::IsRecording() const
+{
+	return m_pFile != nullptr;
+}
+
+void FrameRecorder::Record(const PressureView& pressures)
+{
+	if (!m_pFile)
+		return;
+
+	int slot;
+	{
+		std::unique_lock lock(m_Mutex);
+		const int ringSize = static_cast<int>(m_Ring.size());
+		if (m_Queued == ringSize)
+		{
+			const auto stallStart = std::chrono::steady_clock::now();
+			m_FrameWrittenCV.wait(lock, [&] { return m_Queued < ringSize; });
+			const auto stallEnd = std::chrono::steady_clock::now();
+
+			m_Stats.StalledFrames++;
+			m_Stats.StallNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(stallEnd - stallStart).count();
+		}
+		slot = (m_First + m_Queued) % ringSize;
+	}
+
+	// The slot is not queued, so the writer does not touch it until it is
+	Grid2D<float>& frame = m_Ring[slot];
+	const glm::ivec2 size = glm::min(pressures.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pColumn = frame.GetLine(x);
+		if (pressures.IsColumnContiguous())
+		{
+			std::memcpy(pColumn, &pressures(x, 0), sizeof(float) * size.y);
+			continue;
+		}
+
+		for (int y = 0; y < size.y; ++y)
+		{
+			pColumn[y] = pressures(x, y);
+		}
+	}
+
+	{
+		std::lock_guard lock(m_Mutex);
+		m_Queued++;
+		m_Stats.FramesRecorded++;
+	}
+	m_FrameQueuedCV.notify_one();
+}
+
+FrameRecorder::Stats FrameRecorder::GetStats() const
+{
+	std::lock_guard lock(m_Mutex);
+	return m_Stats;
+}
+
+void FrameRecorder::WriterLoop()
+{
+	while (true)
+	{
+		int slot;
+		{
+			std::unique_lock lock(m_Mutex);
+			m_FrameQueuedCV.wait(lock, [&] { return m_Queued > 0 || m_Stop; });
+			if (m_Queued == 0)
+				return;
+			slot = m_First;
+		}
+
+		EncodeFrame(m_Ring[slot]);
+		const uint32_t byteCount = static_cast<uint32_t>(m_Encoded.size());
+		const bool written = std::fwrite(&byteCount, sizeof(byteCount), 1, m_pFile) == 1 &&
+			std::fwrite(m_Encoded.data(), 1, m_Encoded.size(), m_pFile) == m_Encoded.size();
+
+		{
+			std::lock_guard lock(m_Mutex);
+			m_First = (m_First + 1) % static_cast<int>(m_Ring.size());
+			m_Queued--;
+			m_Stats.FramesWritten++;
+			m_Stats.BytesWritten += sizeof(byteCount) + m_Encoded.size();
+			m_Stats.WriteFailed |= !written;
+		}
+		m_FrameWrittenCV.notify_one();
+	}
+}
+
+void FrameRecorder::EncodeFrame(const Grid2D<float>& frame)
+{
+	m_Encoded.clear();
+
+	// Runs span columns, the frame is one stream of cells in column order
+	uint32_t unchanged = 0;
+	m_Changes.clear();
+	auto flush = [&]()
+	{
+		WriteVarint(unchanged);
+		WriteVarint(static_cast<uint32_t>(m_Changes.size()));
+		for (const uint32_t change : m_Changes)
+		{
+			WriteVarint(change);
+		}
+		unchanged = 0;
+		m_Changes.clear();
+	};
+
+	for (int x = 0; x < m_Size.x; ++x)
+	{
+		const float* pFrame = frame.GetLine(x);
+		uint16_t* pPrevious = m_Previous.GetLine(x);
+		for (int y = 0; y < m_Size.y; ++y)
+		{
+			const uint16_t quantized = Quantize(pFrame[y]);
+			if (quantized == pPrevious[y])
+			{
+				// A run of unchanged cells ends the changed ones before it
+				if (!m_Changes.empty())
+					flush();
+				unchanged++;
+				continue;
+			}
+
+			m_Changes.push_back(ZigZag(static_cast<int32_t>(quantized) - pPrevious[y]));
+			pPrevious[y] = quantized;
+		}
+	}
+
+	if (unchanged > 0 || !m_Changes.empty())
+		flush();
+}
+
+void FrameRecorder::WriteVarint(uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		m_Encoded.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	m_Encoded.push_back(static_cast<uint8_t>(value));
+}
+
+bool ReadRecordedFrames(const std::string& path, const std::function<void(int frame, const Grid2D<float>& pressures)>& frameFn)
+{
+	std::FILE* pFile = std::fopen(path.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	FileHeader header;
+	if (std::fread(&header, sizeof(header), 1, pFile) != 1 || std::memcmp(header.Magic, Magic, sizeof(Magic)) != 0 ||
+		header.Version != Version || header.Width < 0 || header.Height < 0)
+	{
+		std::fclose(pFile);
+		return false;
+	}
+
+	const glm::ivec2 size{ header.Width, header.Height };
+	const size_t cellCount = static_cast<size_t>(size.x) * size.y;
+	Grid2D<uint16_t> quantized(size, 0);
+	Grid2D<float> pressures(size, 0);
+	std::vector<uint8_t> encoded;
+
+	bool valid = true;
+	uint32_t byteCount;
+	for (int frameIdx = 0; valid && std::fread(&byteCount, sizeof(byteCount), 1, pFile) == 1; frameIdx++)
+	{
+		encoded.resize(byteCount);
+		if (std::fread(encoded.data(), 1, byteCount, pFile) != byteCount)
+		{
+			valid = false;
+			break;
+		}
+
+		const uint8_t* pData = encoded.data();
+		const uint8_t* pEnd = pData + encoded.size();
+		size_t cell = 0;
+		while (valid && pData < pEnd)
+		{
+			uint32_t unchanged, changed;
+			valid = ReadVarint(pData, pEnd, unchanged) && ReadVarint(pData, pEnd, changed) &&
+				cell + unchanged + changed <= cellCount;
+			cell += unchanged;
+
+			for (uint32_t i = 0; valid && i < changed; i++, cell++)
+			{
+				uint32_t difference;
+				valid = ReadVarint(pData, pEnd, difference);
+
+				uint16_t& value = quantized(static_cast<int>(cell / size.y), static_cast<int>(cell % size.y));
+				value = static_cast<uint16_t>(value + UnZigZag(difference));
+			}
+		}
+
+		if (!valid || cell != cellCount)
+		{
+			valid = false;
+			break;
+		}
+
+		for (int x = 0; x < size.x; ++x)
+		{
+			for (int y = 0; y < size.y; ++y)
+			{
+				pressures(x, y) = quantized(x, y) / header.QuantizationScale;
+			}
+		}
+		frameFn(frameIdx, pressures);
+	}
+
+	std::fclose(pFile);
+	return valid;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Grid2D.h"
+#include "GridView.h"
+
+// Records the pressures of every step to a file without stalling the simulation.
+// Record() copies the pressures into one of a ring of preallocated frames and returns, a
+// background thread encodes and writes them. Record() only waits when every frame in the ring
+// is still queued, that time is reported in GetStats().
+//
+// Pressures are quantized to 1 / QuantizationScale, each frame stores the difference to the
+// previous one and runs of unchanged cells, which covers all the empty ones, are stored as a
+// count. See ReadRecordedFrames() for the layout.
+class FrameRecorder
+{
+public:
+	static constexpr float QuantizationScale = 4096.f;
+
+	struct Stats
+	{
+		uint64_t FramesRecorded = 0;
+		uint64_t FramesWritten = 0;
+		uint64_t BytesWritten = 0;
+		// Frames that had to wait for the writer because the ring was full, and how long for
+		uint64_t StalledFrames = 0;
+		long long StallNanoseconds = 0;
+		bool WriteFailed = false;
+	};
+
+	FrameRecorder(const glm::ivec2& size, int ringSize = 8);
+	~FrameRecorder();
+
+	FrameRecorder(const FrameRecorder& other) = delete;
+	FrameRecorder(FrameRecorder&& other) = delete;
+	FrameRecorder& operator=(const FrameRecorder& other) = delete;
+	FrameRecorder& operator=(FrameRecorder&& other) = delete;
+
+	// Creates the file and starts the writer thread
+	[[nodiscard]] bool Start(const std::string& path);
+	// Writes every queued frame and closes the file
+	void Stop();
+	[[nodiscard]] bool IsRecording() const;
+
+	// Pressures outside the recorded size are ignored
+	void Record(const PressureView& pressures);
+
+	[[nodiscard]] Stats GetStats() const;
+
+private:
+	void WriterLoop();
+	// Appends the frame to m_Encoded, updates m_Previous
+	void EncodeFrame(const Grid2D<float>& frame);
+	void WriteVarint(uint32_t value);
+
+	glm::ivec2 m_Size;
+	std::vector<Grid2D<float>> m_Ring;
+	std::FILE* m_pFile = nullptr;
+	std::thread m_Writer;
+
+	// Only touched by the writer thread
+	Grid2D<uint16_t> m_Previous;
+	std::vector<uint8_t> m_Encoded;
+	std::vector<uint32_t> m_Changes;
+
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_FrameQueuedCV;
+	std::condition_variable m_FrameWrittenCV;
+	// Frames [m_First, m_First + m_Queued) of the ring, modulo its size, wait to be written
+	int m_First = 0;
+	int m_Queued = 0;
+	bool m_Stop = false;
+	Stats m_Stats;
+};
+
+// Reads a file written by a FrameRecorder and calls frameFn with the pressures of every frame.
+// The file starts with a header:
+//   char[8] "CAFRAMES", uint32 version, int32 width, int32 height, float quantization scale
+// followed by the frames:
+//   uint32 byte count of the rest of the frame
+//   Until every cell of the frame is covered, in column order:
+//   varint count of unchanged cells, varint count of changed cells, a zigzag varint difference
+//   to the previous quantized pressure for each changed cell
+[[nodiscard]] bool ReadRecordedFrames(const std::string& path, const std::function<void(int frame, const Grid2D<float>& pressures)>& frameFn);
@@ -0,0 +1,140 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <glm/glm.hpp>
+
+enum class GridLayout
+{
+	ColumnMajor, // (x, y) and (x, y + 1) are neighbours in memory
+	RowMajor     // (x, y) and (x + 1, y) are neighbours in memory
+};
+
+// Dense 2D grid stored in one cache line aligned allocation.
+// Every line (column or row, depending on the layout) starts on a cache line boundary,
+// so the stride can be larger than the line length.
+template<typename T, GridLayout Layout = GridLayout::ColumnMajor>
+class Grid2D
+{
+	static_assert(std::is_trivially_destructible_v<T>, "Grid2D only holds trivially destructible types");
+
+public:
+	static constexpr size_t Alignment = 64;
+
+	Grid2D() = default;
+	Grid2D(const glm::ivec2& size, const T& value = T{})
+		: m_Size(size)
+		, m_Stride(PaddedLength(Layout == GridLayout::ColumnMajor ? size.y : size.x))
+		, m_pData(Allocate(m_Stride * LineCount()))
+	{
+		std::uninitialized_fill_n(m_pData.get(), m_Stride * LineCount(), value);
+	}
+
+	~Grid2D() = default;
+	Grid2D(const Grid2D& other)
+		: m_Size(other.m_Size)
+		, m_Stride(other.m_Stride)
+		, m_pData(Allocate(m_Stride * LineCount()))
+	{
+		std::uninitialized_copy_n(other.m_pData.get(), m_Stride * LineCount(), m_pData.get());
+	}
+	Grid2D(Grid2D&& other) noexcept = default;
+	Grid2D& operator=(const Grid2D& other)
+	{
+		if (this == &other)
+			return *this;
+
+		if (m_Size != other.m_Size)
+		{
+			Grid2D copy(other);
+			Swap(copy);
+			return *this;
+		}
+
+		std::copy_n(other.m_pData.get(), m_Stride * LineCount(), m_pData.get());
+		return *this;
+	}
+	Grid2D& operator=(Grid2D&& other) noexcept = default;
+
+	[[nodiscard]] T& operator()(int x, int y) { return m_pData.get()[Index(x, y)]; }
+	[[nodiscard]] const T& operator()(int x, int y) const { return m_pData.get()[Index(x, y)]; }
+	[[nodiscard]] T& operator[](const glm::ivec2& position) { return m_pData.get()[Index(position.x, position.y)]; }
+	[[nodiscard]] const T& operator[](const glm::ivec2& position) const { return m_pData.get()[Index(position.x, position.y)]; }
+
+	[[nodiscard]] size_t Index(int x, int y) const
+	{
+		if constexpr (Layout == GridLayout::ColumnMajor)
+			return static_cast<size_t>(x) * m_Stride + y;
+		else
+			return static_cast<size_t>(y) * m_Stride + x;
+	}
+
+	// Pointer to the first element of column x (column major) or row y (row major)
+	[[nodiscard]] T* GetLine(int index) { return m_pData.get() + static_cast<size_t>(index) * m_Stride; }
+	[[nodiscard]] const T* GetLine(int index) const { return m_pData.get() + static_cast<size_t>(index) * m_Stride; }
+
+	[[nodiscard]] T* GetData() { return m_pData.get(); }
+	[[nodiscard]] const T* GetData() const { return m_pData.get(); }
+
+	[[nodiscard]] glm::ivec2 GetSize() const { return m_Size; }
+	[[nodiscard]] int GetWidth() const { return m_Size.x; }
+	[[nodiscard]] int GetHeight() const { return m_Size.y; }
+
+	// Elements between the start of two consecutive lines
+	[[nodiscard]] size_t GetStride() const { return m_Stride; }
+	// Lines in the allocation, GetStride() * GetLineCount() elements in total
+	[[nodiscard]] size_t GetLineCount() const { return LineCount(); }
+	[[nodiscard]] static constexpr GridLayout GetLayout() { return Layout; }
+
+	void Fill(const T& value)
+	{
+		std::fill_n(m_pData.get(), m_Stride * LineCount(), value);
+	}
+
+	void Swap(Grid2D& other) noexcept
+	{
+		std::swap(m_Size, other.m_Size);
+		std::swap(m_Stride, other.m_Stride);
+		std::swap(m_pData, other.m_pData);
+	}
+
+private:
+	struct AlignedDeleter
+	{
+		void operator()(T* pData) const
+		{
+			::operator delete(pData, std::align_val_t{ Alignment });
+		}
+	};
+
+	static T* Allocate(size_t count)
+	{
+		return static_cast<T*>(::operator new(std::max<size_t>(count, 1) * sizeof(T), std::align_val_t{ Alignment }));
+	}
+
+	static size_t PaddedLength(int length)
+	{
+		// Smallest element count that makes a line a whole number of cache lines
+		const size_t multiple = Alignment / std::gcd(sizeof(T), Alignment);
+		return (static_cast<size_t>(length) + multiple - 1) / multiple * multiple;
+	}
+
+	[[nodiscard]] size_t LineCount() const
+	{
+		return static_cast<size_t>(Layout == GridLayout::ColumnMajor ? m_Size.x : m_Size.y);
+	}
+
+	glm::ivec2 m_Size{ 0, 0 };
+	size_t m_Stride = 0;
+	std::unique_ptr<T, AlignedDeleter> m_pData;
+};
+
+template<typename T, GridLayout Layout>
+void swap(Grid2D<T, Layout>& a, Grid2D<T, Layout>& b) noexcept
+{
+	a.Swap(b);
+}
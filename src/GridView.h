@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "Grid2D.h"
+
+// Non-owning, read-only view of a 2D field that lives in someone else's buffer.
+// Strides are in bytes, so a view can also address one member of a grid of structs.
+// A view stays valid until the world it came from is updated or resized.
+template<typename T>
+class GridView
+{
+public:
+	GridView() = default;
+	GridView(const T* pData, const glm::ivec2& size, ptrdiff_t columnStride, ptrdiff_t rowStride)
+		: m_pData(reinterpret_cast<const std::byte*>(pData))
+		, m_Size(size)
+		, m_ColumnStride(columnStride)
+		, m_RowStride(rowStride)
+	{}
+
+	template<GridLayout Layout>
+	GridView(const Grid2D<T, Layout>& grid)
+		: GridView(grid.GetData(), grid.GetSize(), ColumnStrideOf(grid, sizeof(T)), RowStrideOf(grid, sizeof(T)))
+	{}
+
+	// View of one member of every element in a grid of structs
+	template<typename Cell, GridLayout Layout>
+	GridView(const Grid2D<Cell, Layout>& grid, T Cell::* member)
+		: GridView(&(grid.GetData()->*member), grid.GetSize(), ColumnStrideOf(grid, sizeof(Cell)), RowStrideOf(grid, sizeof(Cell)))
+	{}
+
+	[[nodiscard]] const T& operator()(int x, int y) const
+	{
+		return *reinterpret_cast<const T*>(m_pData + x * m_ColumnStride + y * m_RowStride);
+	}
+	[[nodiscard]] const T& operator[](const glm::ivec2& position) const
+	{
+		return (*this)(position.x, position.y);
+	}
+
+	[[nodiscard]] glm::ivec2 GetSize() const { return m_Size; }
+	[[nodiscard]] int GetWidth() const { return m_Size.x; }
+	[[nodiscard]] int GetHeight() const { return m_Size.y; }
+
+	// Bytes between (x, y) and (x + 1, y)
+	[[nodiscard]] ptrdiff_t GetColumnStride() const { return m_ColumnStride; }
+	// Bytes between (x, y) and (x, y + 1)
+	[[nodiscard]] ptrdiff_t GetRowStride() const { return m_RowStride; }
+
+	// True when every column is a contiguous array of T
+	[[nodiscard]] bool IsColumnContiguous() const { return m_RowStride == sizeof(T); }
+
+private:
+	template<typename Cell, GridLayout Layout>
+	static ptrdiff_t ColumnStrideOf(const Grid2D<Cell, Layout>& grid, size_t elementSize)
+	{
+		return static_cast<ptrdiff_t>(Layout == GridLayout::ColumnMajor ? grid.GetStride() * elementSize : elementSize);
+	}
+	template<typename Cell, GridLayout Layout>
+	static ptrdiff_t RowStrideOf(const Grid2D<Cell, Layout>& grid, size_t elementSize)
+	{
+		return static_cast<ptrdiff_t>(Layout == GridLayout::ColumnMajor ? elementSize : grid.GetStride() * elementSize);
+	}
+
+	const std::byte* m_pData = nullptr;
+	glm::ivec2 m_Size{ 0, 0 };
+	ptrdiff_t m_ColumnStride = 0;
+	ptrdiff_t m_RowStride = 0;
+};
+
+using PressureView = GridView<float>;
+using BoundaryView = GridView<bool>;
+
+// Non-owning, read-only view of one bit per cell, packed row by row.
+// Bit x % 64 of word x / 64 of row y is cell (x, y), rows start wordStride words apart.
+class BitmaskView
+{
+public:
+	static constexpr int WordBits = 64;
+
+	BitmaskView() = default;
+	BitmaskView(const uint64_t* pWords, const glm::ivec2& size, size_t wordStride)
+		: m_pWords(pWords)
+		, m_Size(size)
+		, m_WordStride(wordStride)
+	{}
+	// Tightly packed rows
+	BitmaskView(const uint64_t* pWords, const glm::ivec2& size)
+		: BitmaskView(pWords, size, GetWordCount(size.x))
+	{}
+
+	[[nodiscard]] bool operator()(int x, int y) const
+	{
+		return (GetRow(y)[x / WordBits] >> (x % WordBits)) & 1;
+	}
+
+	[[nodiscard]] const uint64_t* GetRow(int y) const { return m_pWords + static_cast<size_t>(y) * m_WordStride; }
+
+	[[nodiscard]] glm::ivec2 GetSize() const { return m_Size; }
+	[[nodiscard]] int GetWidth() const { return m_Size.x; }
+	[[nodiscard]] int GetHeight() const { return m_Size.y; }
+	[[nodiscard]] size_t GetWordStride() const { return m_WordStride; }
+
+	[[nodiscard]] static size_t GetWordCount(int width) { return (static_cast<size_t>(width) + WordBits - 1) / WordBits; }
+
+private:
+	const uint64_t* m_pWords = nullptr;
+	glm::ivec2 m_Size{ 0, 0 };
+	size_t m_WordStride = 0;
+};
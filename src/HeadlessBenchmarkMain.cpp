@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NoitaWorld.h"
+#include "NoitaBitboardWorld.h"
+#include "PressWorld.h"
+#include "PressVelWorld.h"
+#include "PressVelWorldThreaded.h"
+#include "Snapshot.h"
+#include "FrameRecorder.h"
+#include "CpuFeatures.h"
+
+// Benchmark without a window, every setting comes from the command line
+struct BenchmarkSettings
+{
+	std::string WorldType = "pressvel-threaded";
+	std::string Scenario = "left-hole";
+	int MinSize = 10;
+	int MaxSize = 250;
+	int SizeStep = 10;
+	int Steps = 4000;
+	int WarmupSteps = 0;
+	// Steps per Update() call
+	int Batch = 1;
+	int Threads = 0;
+	// Pin the workers of the shared scheduler to hardware threads
+	int PinThreads = 0;
+	int Seed = 0;
+	std::string Format = "csv";
+	// Start from a saved world instead of the scenario, its size replaces the size range
+	std::string LoadSnapshotPath;
+	// Save the world after the warmup steps
+	std::string SaveSnapshotPath;
+	// Record the pressures of every timed step
+	std::string RecordPath;
+	// Tune the thread count and tile size of the threaded worlds, remembering the results in this file
+	std::string TunePath;
+	// Check that every world steps the same however it is run instead of timing anything
+	int Verify = 0;
+};
+
+struct StepTimings
+{
+	long long Min;
+	long long Median;
+	long long P99;
+	long long Total;
+
+	// Summed over the timed steps, only filled in when built with CA_STEP_STATS
+	StepStats Stats;
+};
+
+void PrintUsage()
+{
+	std::cerr
+		<< "Usage: CellularAutomata_bench [options]\n"
+		<< "  --world <type>       noita, noita-parallel, noita-bitboard, press, pressvel, pressvel-threaded\n"
+		<< "  --scenario <name>    full, top-hole, left-hole\n"
+		<< "  --min-size <n>       smallest world size\n"
+		<< "  --max-size <n>       largest world size\n"
+		<< "  --size-step <n>      size increment\n"
+		<< "  --steps <n>          timed steps per size\n"
+		<< "  --warmup <n>         untimed steps before the timed ones\n"
+		<< "  --batch <n>          steps per update call, worlds like press do them in one sweep\n"
+		<< "  --threads <n>        threads for the parallel worlds, 0 picks automatically\n"
+		<< "  --pin-threads <0|1>  pin the worker threads to hardware threads\n"
+		<< "  --seed <n>           seed of the random numbers\n"
+		<< "  --format <format>    csv or json\n"
+		<< "  --load-snapshot <f>  start from a saved world instead of the scenario\n"
+		<< "  --save-snapshot <f>  save the world after the warmup, the last size overwrites the others\n"
+		<< "  --record <f>         record the pressures of the timed steps, the last size overwrites the others\n"
+		<< "  --tune <f>           tune the threads and tiles of pressvel-threaded, the results are kept in the file\n"
+		<< "  --verify <0|1>       check that kernels, batches, threads, tiles and snapshots don't change any world, exits with 1 if they do\n";
+}
+
+bool ParseInt(const char* pText, int& value)
+{
+	char* pEnd;
+	const long parsed = std::strtol(pText, &pEnd, 10);
+	if (pEnd == pText || *pEnd != '\0' || parsed < 0)
+		return false;
+
+	value = static_cast<int>(parsed);
+	return true;
+}
+
+bool ParseArguments(int argc, char* argv[], BenchmarkSettings& settings)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string option = argv[i];
+		if (option == "--help" || i + 1 >= argc)
+			return false;
+
+		const char* pValue = argv[++i];
+		bool valid = true;
+
+		if (option == "--world")
+			settings.WorldType = pValue;
+		else if (option == "--scenario")
+			settings.Scenario = pValue;
+		else if (option == "--format")
+			settings.Format = pValue;
+		else if (option == "--load-snapshot")
+			settings.LoadSnapshotPath = pValue;
+		else if (option == "--save-snapshot")
+			settings.SaveSnapshotPath = pValue;
+		else if (option == "--record")
+			settings.RecordPath = pValue;
+		else if (option == "--tune")
+			settings.TunePath = pValue;
+		else if (option == "--min-size")
+			valid = ParseInt(pValue, settings.MinSize);
+		else if (option == "--max-size")
+			valid = ParseInt(pValue, settings.MaxSize);
+		else if (option == "--size-step")
+			valid = ParseInt(pValue, settings.SizeStep) && settings.SizeStep > 0;
+		else if (option == "--steps")
+			valid = ParseInt(pValue, settings.Steps) && settings.Steps > 0;
+		else if (option == "--warmup")
+			valid = ParseInt(pValue, settings.WarmupSteps);
+		else if (option == "--batch")
+			valid = ParseInt(pValue, settings.Batch) && settings.Batch > 0;
+		else if (option == "--threads")
+			valid = ParseInt(pValue, settings.Threads);
+		else if (option == "--pin-threads")
+			valid = ParseInt(pValue, settings.PinThreads) && settings.PinThreads <= 1;
+		else if (option == "--seed")
+			valid = ParseInt(pValue, settings.Seed);
+		else if (option == "--verify")
+			valid = ParseInt(pValue, settings.Verify) && settings.Verify <= 1;
+		else
+			valid = false;
+
+		if (!valid)
+		{
+			std::cerr << "Invalid option " << option << " " << pValue << std::endl;
+			return false;
+		}
+	}
+
+	return settings.Format == "csv" || settings.Format == "json";
+}
+
+std::unique_ptr<World> CreateWorld(const std::string& type, const glm::ivec2& size, int threads)
+{
+	if (type == "noita")
+		return std::make_unique<NoitaWorld>(size);
+
+	if (type == "noita-parallel")
+	{
+		auto pWorld = std::make_unique<NoitaWorld>(size);
+		pWorld->SetParallelEnabled(true, threads);
+		return pWorld;
+	}
+
+	if (type == "noita-bitboard")
+		return std::make_unique<NoitaBitboardWorld>(size);
+
+	if (type == "press")
+		return std::make_unique<PressWorld>(size);
+
+	if (type == "pressvel")
+		return std::make_unique<PressVelWorld>(size);
+
+	if (type == "pressvel-threaded")
+		return std::make_unique<PressVelWorldThreaded>(size, 32, threads);
+
+	return nullptr;
+}
+
+bool FillScenario(World& world, const std::string& scenario)
+{
+	const glm::ivec2 size = world.GetSize();
+
+	if (scenario == "full")
+	{
+		world.FillWater({ 0, 0 }, size, true);
+		return true;
+	}
+
+	if (scenario == "top-hole")
+	{
+		// Water above a floor with a 5 cell hole in the middle
+		world.FillWater({ 0, size.y / 2 + 1 }, size, true);
+		world.FillBoundary({ 0, size.y / 2 }, { size.x / 2 - 2, size.y / 2 + 1 }, true);
+		world.FillBoundary({ size.x / 2 + 3, size.y / 2 }, { size.x, size.y / 2 + 1 }, true);
+		return true;
+	}
+
+	if (scenario == "left-hole")
+	{
+		// Water left of a wall with a 4 cell gap at the bottom
+		world.FillWater({ 0, 0 }, { size.x / 2, size.y }, true);
+		world.FillBoundary({ size.x / 2, 4 }, { size.x / 2 + 1, size.y }, true);
+		return true;
+	}
+
+	return false;
+}
+
+// The recorder is fed after every update call, its cost is part of the step time.
+// With batches every step of a batch counts as taking the average time of the batch.
+StepTimings MeasureSteps(World& world, int steps, int batch, FrameRecorder* pRecorder)
+{
+	std::vector<long long> stepTimes;
+	StepStats stats;
+	StepTimings timings{};
+	for (int i = 0; i < steps; i += batch)
+	{
+		const int batchSteps = std::min(batch, steps - i);
+		const auto updateStart = std::chrono::steady_clock::now();
+		world.Update(batchSteps);
+		if (pRecorder)
+			pRecorder->Record(world.GetPressureView());
+		const auto updateEnd = std::chrono::steady_clock::now();
+
+		const long long batchTime = std::chrono::duration_cast<std::chrono::nanoseconds>(updateEnd - updateStart).count();
+		stepTimes.insert(stepTimes.end(), batchSteps, batchTime / batchSteps);
+		timings.Total += batchTime;
+
+		stats.Add(world.GetStepStats());
+	}
+
+	timings.Stats = std::move(stats);
+
+	std::sort(stepTimes.begin(), stepTimes.end());
+	timings.Min = stepTimes.front();
+	timings.Median = stepTimes[stepTimes.size() / 2];
+	timings.P99 = stepTimes[std::min(stepTimes.size() - 1, stepTimes.size() * 99 / 100)];
+	return timings;
+}
+
+// One way of running a world for --verify, every one of them has to end up with the same world
+struct VerifyRun
+{
+	const char* pName;
+	int Threads = 0;
+	int TileSize = 32;
+	SimdLevel MaxSimdLevel = SimdLevel::Avx2;
+	int Batch = 1;
+	// Saved halfway and loaded into a new world that does the rest
+	bool SaveAndLoad = false;
+};
+
+uint64_t HashWorld(const World& world)
+{
+	// FNV-1a over the bits of every pressure and boundary
+	const PressureView pressures = world.GetPressureView();
+	const BoundaryView boundaries = world.GetBoundaryView();
+	uint64_t hash = 14695981039346656037ull;
+	for (int x = 0; x < pressures.GetWidth(); ++x)
+	{
+		for (int y = 0; y < pressures.GetHeight(); ++y)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &pressures(x, y), sizeof(bits));
+			hash = (hash ^ bits) * 1099511628211ull;
+			hash = (hash ^ boundaries(x, y)) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+std::unique_ptr<World> CreateVerifyWorld(const std::string& type, const glm::ivec2& size, const VerifyRun& run, uint32_t seed)
+{
+	SetMaxSimdLevel(run.MaxSimdLevel);
+	std::unique_ptr<World> pWorld = CreateWorld(type, size, run.Threads);
+	SetMaxSimdLevel(SimdLevel::Avx2);
+
+	if (auto* pThreadedWorld = dynamic_cast<PressVelWorldThreaded*>(pWorld.get()))
+		pThreadedWorld->SetTileSize(run.TileSize);
+	pWorld->SetSeed(seed);
+	return pWorld;
+}
+
+bool StepVerifyRun(const std::string& type, const glm::ivec2& size, const VerifyRun& run, const BenchmarkSettings& settings,
+	const std::string& snapshotPath, uint64_t& hash)
+{
+	std::unique_ptr<World> pWorld = CreateVerifyWorld(type, size, run, static_cast<uint32_t>(settings.Seed));
+	if (!FillScenario(*pWorld, settings.Scenario))
+		return false;
+
+	// Batches stop at the halfway point, so the snapshot is taken after the same step in every run
+	const int halfway = settings.Steps / 2;
+	for (int step = 0; step < settings.Steps;)
+	{
+		if (step == halfway && run.SaveAndLoad)
+		{
+			if (!SaveSnapshot(*pWorld, snapshotPath))
+				return false;
+
+			pWorld = CreateVerifyWorld(type, size, run, static_cast<uint32_t>(settings.Seed));
+			if (!LoadSnapshot(*pWorld, snapshotPath))
+				return false;
+		}
+
+		const int batchEnd = step < halfway ? halfway : settings.Steps;
+		const int count = std::min(run.Batch, batchEnd - step);
+		pWorld->Update(count);
+		step += count;
+	}
+
+	hash = HashWorld(*pWorld);
+	return true;
+}
+
+// Prints a line per world, size and run, returns the number of runs that did not match the first
+int Verify(const BenchmarkSettings& settings)
+{
+	std::vector<VerifyRun> runs = {
+		{ "reference" },
+		{ "batch-7", 0, 32, SimdLevel::Avx2, 7 },
+		{ "snapshot", 0, 32, SimdLevel::Avx2, 1, true },
+		{ "batch-5-snapshot", 0, 32, SimdLevel::Avx2, 5, true },
+		{ "scalar", 0, 32, SimdLevel::Scalar },
+		{ "sse2", 0, 32, SimdLevel::Sse2 },
+		{ "threads-1", 1 },
+		{ "threads-2", 2 },
+		{ "threads-4", 4 },
+		{ "tiles-8", 0, 8 },
+		{ "tiles-16-threads-3", 3, 16 },
+		{ "tiles-64", 0, 64 },
+	};
+
+	const std::string snapshotPath = (std::filesystem::temp_directory_path() / "CellularAutomata_verify.snapshot").string();
+	const char* worldTypes[] = { "noita", "noita-parallel", "noita-bitboard", "press", "pressvel", "pressvel-threaded" };
+	// Odd sizes, so the vectorized kernels, tiles and chunks all have a partial one at the end
+	const glm::ivec2 sizes[] = { { 61, 45 }, { 131, 70 } };
+
+	std::cout << "world,size,run,hash,result" << std::endl;
+	int mismatches = 0;
+	for (const char* pType : worldTypes)
+	{
+		for (const glm::ivec2& size : sizes)
+		{
+			uint64_t reference = 0;
+			for (const VerifyRun& run : runs)
+			{
+				uint64_t hash;
+				const bool stepped = StepVerifyRun(pType, size, run, settings, snapshotPath, hash);
+				if (&run == &runs.front())
+					reference = hash;
+
+				const bool match = stepped && hash == reference;
+				mismatches += match ? 0 : 1;
+				std::cout << pType << "," << size.x << "x" << size.y << "," << run.pName << "," << std::hex << hash << std::dec << ","
+					<< (!stepped ? "failed" : match ? "ok" : "mismatch") << std::endl;
+			}
+		}
+	}
+
+	std::filesystem::remove(snapshotPath);
+	return mismatches;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkSettings settings;
+	if (!ParseArguments(argc, argv, settings))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// Every world of the run shares one set of workers, it only needs replacing for more threads than
+	// the hardware has or to pin them
+	const int hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+	if (settings.PinThreads || settings.Threads > hardwareThreads)
+	{
+		WorkStealingScheduler::SetShared(std::make_shared<WorkStealingScheduler>(std::max(settings.Threads, hardwareThreads),
+			settings.PinThreads ? WorkStealingScheduler::Affinity::PinToCores : WorkStealingScheduler::Affinity::None));
+	}
+
+	if (settings.Verify)
+	{
+		// Enough workers for the thread counts of the runs, even on smaller machines
+		if (hardwareThreads < 4 && !settings.PinThreads && settings.Threads <= hardwareThreads)
+			WorkStealingScheduler::SetShared(std::make_shared<WorkStealingScheduler>(4));
+		return Verify(settings) == 0 ? 0 : 1;
+	}
+
+	const bool json = settings.Format == "json";
+	if (json)
+		std::cout << "[" << std::endl;
+	else
+		std::cout << "world,scenario,size,threads,steps,min_ns,median_ns,p99_ns,total_ns,cells,phases" << std::endl;
+
+	SnapshotReader snapshot;
+	if (!settings.LoadSnapshotPath.empty())
+	{
+		if (!snapshot.Open(settings.LoadSnapshotPath))
+		{
+			std::cerr << "Can't read snapshot " << settings.LoadSnapshotPath << std::endl;
+			return 1;
+		}
+		settings.MinSize = snapshot.GetSize().x;
+		settings.MaxSize = snapshot.GetSize().x;
+		settings.Scenario = "snapshot";
+	}
+
+	bool first = true;
+	for (int size = settings.MinSize; size <= settings.MaxSize; size += settings.SizeStep)
+	{
+		const glm::ivec2 worldSize = settings.LoadSnapshotPath.empty() ? glm::ivec2{ size, size } : snapshot.GetSize();
+		std::unique_ptr<World> pWorld = CreateWorld(settings.WorldType, worldSize, settings.Threads);
+		if (!pWorld)
+		{
+			std::cerr << "Unknown world type " << settings.WorldType << std::endl;
+			return 1;
+		}
+		pWorld->SetSeed(static_cast<uint32_t>(settings.Seed));
+
+		if (!settings.LoadSnapshotPath.empty())
+		{
+			if (!LoadSnapshot(*pWorld, snapshot))
+			{
+				std::cerr << "Snapshot " << settings.LoadSnapshotPath << " is not of a " << settings.WorldType << " world" << std::endl;
+				return 1;
+			}
+		}
+		else if (!FillScenario(*pWorld, settings.Scenario))
+		{
+			std::cerr << "Unknown scenario " << settings.Scenario << std::endl;
+			return 1;
+		}
+
+		// Tuned on the world as it will be timed, the tries don't change it
+		if (auto* pThreadedWorld = dynamic_cast<PressVelWorldThreaded*>(pWorld.get()); pThreadedWorld && !settings.TunePath.empty())
+		{
+			if (!pThreadedWorld->AutoTune(settings.TunePath))
+				std::cerr << "Can't update tuning file " << settings.TunePath << std::endl;
+			std::cerr << "Size " << size << " tuned to " << pThreadedWorld->GetThreadCount() << " threads and "
+				<< pThreadedWorld->GetTileSize() << " cell tiles" << std::endl;
+		}
+
+		pWorld->Update(settings.WarmupSteps);
+
+		if (!settings.SaveSnapshotPath.empty() && !SaveSnapshot(*pWorld, settings.SaveSnapshotPath))
+		{
+			std::cerr << "Can't write snapshot " << settings.SaveSnapshotPath << std::endl;
+			return 1;
+		}
+
+		std::unique_ptr<FrameRecorder> pRecorder;
+		if (!settings.RecordPath.empty())
+		{
+			pRecorder = std::make_unique<FrameRecorder>(worldSize);
+			if (!pRecorder->Start(settings.RecordPath))
+			{
+				std::cerr << "Can't write recording " << settings.RecordPath << std::endl;
+				return 1;
+			}
+		}
+
+		const StepTimings timings = MeasureSteps(*pWorld, settings.Steps, settings.Batch, pRecorder.get());
+
+		if (pRecorder)
+		{
+			pRecorder->Stop();
+			const FrameRecorder::Stats recordStats = pRecorder->GetStats();
+			std::cerr << "Recorded " << recordStats.FramesWritten << " frames in " << recordStats.BytesWritten << " bytes, "
+				<< recordStats.StalledFrames << " frames waited " << recordStats.StallNanoseconds << " ns for the writer"
+				<< (recordStats.WriteFailed ? ", writing failed" : "") << std::endl;
+		}
+
+		if (json)
+		{
+			std::cout << (first ? "" : ",\n")
+				<< "  {\"world\": \"" << settings.WorldType << "\", \"scenario\": \"" << settings.Scenario
+				<< "\", \"size\": " << size << ", \"threads\": " << settings.Threads << ", \"steps\": " << settings.Steps
+				<< ", \"min_ns\": " << timings.Min << ", \"median_ns\": " << timings.Median
+				<< ", \"p99_ns\": " << timings.P99 << ", \"total_ns\": " << timings.Total
+				<< ", \"cells\": " << timings.Stats.CellsProcessed << ", \"phases\": {";
+			for (size_t i = 0; i < timings.Stats.Phases.size(); i++)
+			{
+				std::cout << (i == 0 ? "" : ", ") << "\"" << timings.Stats.Phases[i].pName << "\": " << timings.Stats.Phases[i].Nanoseconds;
+			}
+			std::cout << "}, \"thread_times\": [";
+			for (size_t i = 0; i < timings.Stats.Threads.size(); i++)
+			{
+				std::cout << (i == 0 ? "" : ", ") << "{\"busy_ns\": " << timings.Stats.Threads[i].BusyNanoseconds
+					<< ", \"wait_ns\": " << timings.Stats.Threads[i].WaitNanoseconds << "}";
+			}
+			std::cout << "]}";
+		}
+		else
+		{
+			std::cout << settings.WorldType << "," << settings.Scenario << "," << size << "," << settings.Threads << ","
+				<< settings.Steps << "," << timings.Min << "," << timings.Median << "," << timings.P99 << ","
+				<< timings.Total << "," << timings.Stats.CellsProcessed << ",";
+			for (size_t i = 0; i < timings.Stats.Phases.size(); i++)
+			{
+				std::cout << (i == 0 ? "" : ";") << timings.Stats.Phases[i].pName << "=" << timings.Stats.Phases[i].Nanoseconds;
+			}
+			std::cout << std::endl;
+		}
+		first = false;
+	}
+
+	if (json)
+		std::cout << "\n]" << std::endl;
+
+	return 0;
+}
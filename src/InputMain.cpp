@@ -8,12 +8,18 @@
 #include "PressWorld.h"
 #include "PressVelWorld.h"
 #include "PressVelWorldThreaded.h"
+#include "WorldRenderer.h"
+#include "SimulationThread.h"
 
 // Size
 constexpr int g_WorldWidth = 50;
 constexpr int g_WorldHeight = 50;
 constexpr int g_WindowWidth = 500;
 constexpr int g_WindowHeight = 500;
+constexpr int g_BrushRadius = 0;
+
+// Run the world on its own thread, rendering the latest step it finished
+constexpr bool g_SimulationThread = true;
 
 // Rendering
 SDL_Renderer* g_pRenderer = nullptr;
@@ -46,89 +52,10 @@ bool HandleInput()
 	return false;
 }
 
-// Render
-void RenderWorld(const World& world)
-{
-	const float cellWidth = static_cast<float>(g_WindowWidth) / static_cast<float>(world.GetSize().x);
-	const float cellHeight = static_cast<float>(g_WindowHeight) / static_cast<float>(world.GetSize().y);
-
-	const auto& pressures = world.GetWaterPressures();
-
-	for (int x = 0; x < world.GetSize().x; ++x)
-	{
-		for (int y = 0; y < world.GetSize().y; ++y)
-		{
-			if (pressures[x][y] < 0.001f)
-				continue;
-
-			if (pressures[x][y] <= 1)
-			{
-				if (y + 1 < g_WorldHeight && pressures[x][y + 1] > 0.001f)
-				{
-					SDL_FRect rect = {
-						x * cellWidth,
-						g_WindowHeight - (y + 1) * cellHeight,
-						cellWidth,
-						cellHeight
-					};
-
-					SDL_SetRenderDrawColor(g_pRenderer, 255 / 2, 255 / 2, 255, 255);
-					SDL_RenderFillRectF(g_pRenderer, &rect);
-				}
-				else
-				{
-					SDL_FRect rect{
-						x * cellWidth,
-						g_WindowHeight - (y + pressures[x][y]) * cellHeight,
-						cellWidth,
-						pressures[x][y] * cellHeight
-					};
-
-					SDL_SetRenderDrawColor(g_pRenderer, 255 / 2, 255 / 2, 255, 255);
-					SDL_RenderFillRectF(g_pRenderer, &rect);
-				}
-			}
-			else
-			{
-				SDL_FRect rect = {
-					x * cellWidth,
-					g_WindowHeight - (y + 1) * cellHeight,
-					cellWidth,
-					cellHeight
-				};
-
-				SDL_SetRenderDrawColor(g_pRenderer, 255 / (pressures[x][y] + 1), 255 / (pressures[x][y] + 1), 255, 255);
-				SDL_RenderFillRectF(g_pRenderer, &rect);
-			}
-		}
-	}
-
-	const auto& boundaries = world.GetBoundaries();
-
-	for (int x = 0; x < world.GetSize().x; ++x)
-	{
-		for (int y = 0; y < world.GetSize().y; ++y)
-		{
-			if (!boundaries[x][y])
-				continue;
-
-			SDL_FRect rect{
-				x * cellWidth,
-				g_WindowHeight - (y + 1) * cellHeight,
-				cellWidth,
-				cellHeight
-			};
-
-			SDL_SetRenderDrawColor(g_pRenderer, 0, 0, 0, 255);
-			SDL_RenderFillRectF(g_pRenderer, &rect);
-		}
-	}
-}
-
 int main()
 {
     // Init SDL
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
         std::cout << "error initializing SDL:" << SDL_GetError() << std::endl;
 
     // Create window and renderer
@@ -138,7 +65,8 @@ int main()
 		g_WindowWidth, g_WindowHeight, 
 		0);
 
-	g_pRenderer = SDL_CreateRenderer(pWindow, -1, SDL_RENDERER_ACCELERATED);
+	g_pRenderer = WorldRenderer::CreateRenderer(pWindow);
+	WorldRenderer worldRenderer(g_pRenderer, { g_WindowWidth, g_WindowHeight });
 
 	// Create world
 	//NoitaWorld world({ g_WorldWidth, g_WorldHeight });
@@ -149,19 +77,36 @@ int main()
 	constexpr float updateInterval = 0.01f;
 	float timer = 0;
 
+	SimulationThread simulation(world, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<float>(updateInterval)));
+	if (g_SimulationThread)
+		simulation.Start();
+
 	// Loop
 	while(!HandleInput())
 	{
 		const auto start = std::chrono::high_resolution_clock::now();
 
 		glm::ivec2 wPos = { (float)g_MouseX / g_WindowWidth * g_WorldWidth, (float)g_MouseY / g_WindowHeight * g_WorldHeight };
+		if (g_SimulationThread)
+		{
+			if (g_LeftMousePressed)
+				simulation.PostEdit({ wPos, g_BrushRadius, true, true });
+			if (g_RightMousePressed)
+				simulation.PostEdit({ wPos, g_BrushRadius, false, true });
+
+			const SimulationThread::Frame& frame = simulation.AcquireLatestFrame();
+			worldRenderer.Render(frame.Pressures, frame.Boundaries);
+			SDL_RenderPresent(g_pRenderer);
+			continue;
+		}
+
 		if (g_LeftMousePressed)
 		{
-			world.SetBoundary(wPos, true);
+			world.StampBoundary(wPos, g_BrushRadius, true);
 		}
 		if (g_RightMousePressed)
 		{
-			world.SetWater(wPos, true);
+			world.StampWater(wPos, g_BrushRadius, true);
 		}
 
 		while (timer > 0)
@@ -170,11 +115,7 @@ int main()
 			timer -= updateInterval;
 		}
 
-		SDL_SetRenderDrawColor(g_pRenderer, 255, 255, 255, 255);
-		SDL_RenderClear(g_pRenderer);
-
-		RenderWorld(world);
-
+		worldRenderer.Render(world);
 		SDL_RenderPresent(g_pRenderer);
 
 		const auto end = std::chrono::high_resolution_clock::now();
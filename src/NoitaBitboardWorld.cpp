@@ -0,0 +1,353 @@
+#include "NoitaBitboardWorld.h"
+#include "CounterRng.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+
+NoitaBitboardWorld::NoitaBitboardWorld(const glm::ivec2& size)
+	: m_Water({ (size.x + WordBits - 1) / WordBits, size.y }, 0)
+	, m_Boundaries({ (size.x + WordBits - 1) / WordBits, size.y }, 0)
+	, m_Dirs({ (size.x + WordBits - 1) / WordBits, size.y }, 0)
+	, m_Size(size)
+	, m_WordCount((size.x + WordBits - 1) / WordBits)
+	, m_LastWordMask(size.x % WordBits == 0 ? ~Word{ 0 } : (Word{ 1 } << (size.x % WordBits)) - 1)
+	, m_Empty(m_WordCount)
+	, m_Movers(m_WordCount)
+	, m_Candidates(m_WordCount)
+	, m_WaterPlane(size, 0)
+	, m_BoundaryPlane(size, false)
+{}
+
+glm::ivec2 NoitaBitboardWorld::GetSize() const
+{
+	return m_Size;
+}
+
+void NoitaBitboardWorld::SetWater(const glm::ivec2& position, bool water)
+{
+	if (!IsPositionInBounds(position))
+		return;
+
+	Word& waterWord = m_Water.GetLine(position.y)[position.x / WordBits];
+	const Word bit = Word{ 1 } << (position.x % WordBits);
+
+	if (water)
+	{
+		m_Boundaries.GetLine(position.y)[position.x / WordBits] &= ~bit;
+		m_BoundaryPlane[position] = false;
+		waterWord |= bit;
+
+		Word& dirWord = m_Dirs.GetLine(position.y)[position.x / WordBits];
+		dirWord = RandomBits(m_Seed, m_Step, position) & 1 ? dirWord | bit : dirWord & ~bit;
+	}
+	else
+	{
+		waterWord &= ~bit;
+	}
+	m_WaterPlaneDirty = true;
+}
+PressureView NoitaBitboardWorld::GetPressureView() const
+{
+	if (m_WaterPlaneDirty)
+		UnpackWater();
+
+	return PressureView(m_WaterPlane);
+}
+
+void NoitaBitboardWorld::SetBoundary(const glm::ivec2& position, bool boundary)
+{
+	if (!IsPositionInBounds(position))
+		return;
+
+	const Word bit = Word{ 1 } << (position.x % WordBits);
+	Word& boundaryWord = m_Boundaries.GetLine(position.y)[position.x / WordBits];
+	boundaryWord = boundary ? boundaryWord | bit : boundaryWord & ~bit;
+	m_BoundaryPlane[position] = boundary;
+
+	if (boundary)
+	{
+		m_Water.GetLine(position.y)[position.x / WordBits] &= ~bit;
+		m_WaterPlaneDirty = true;
+	}
+}
+BoundaryView NoitaBitboardWorld::GetBoundaryView() const
+{
+	return BoundaryView(m_BoundaryPlane);
+}
+
+void NoitaBitboardWorld::SetWaterRegion(const Region& region, bool water)
+{
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int wordIdx = x / WordBits;
+		const Word bit = Word{ 1 } << (x % WordBits);
+
+		for (int y = column.YStart; y < column.YEnd; ++y)
+		{
+			if (!water)
+			{
+				m_Water.GetLine(y)[wordIdx] &= ~bit;
+				continue;
+			}
+
+			m_Water.GetLine(y)[wordIdx] |= bit;
+			m_Boundaries.GetLine(y)[wordIdx] &= ~bit;
+			m_BoundaryPlane(x, y) = false;
+
+			Word& dirWord = m_Dirs.GetLine(y)[wordIdx];
+			dirWord = RandomBits(m_Seed, m_Step, { x, y }) & 1 ? dirWord | bit : dirWord & ~bit;
+		}
+	}
+	m_WaterPlaneDirty = true;
+}
+
+void NoitaBitboardWorld::SetBoundaryRegion(const Region& region, bool boundary)
+{
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int wordIdx = x / WordBits;
+		const Word bit = Word{ 1 } << (x % WordBits);
+
+		std::fill_n(m_BoundaryPlane.GetLine(x) + column.YStart, column.YEnd - column.YStart, boundary);
+		for (int y = column.YStart; y < column.YEnd; ++y)
+		{
+			Word& boundaryWord = m_Boundaries.GetLine(y)[wordIdx];
+			boundaryWord = boundary ? boundaryWord | bit : boundaryWord & ~bit;
+			if (boundary)
+				m_Water.GetLine(y)[wordIdx] &= ~bit;
+		}
+	}
+	m_WaterPlaneDirty = true;
+}
+
+void NoitaBitboardWorld::LoadPressures(const PressureView& pressures)
+{
+	const glm::ivec2 size = glm::min(pressures.GetSize(), m_Size);
+	for (int y = 0; y < size.y; ++y)
+	{
+		Word* pWater = m_Water.GetLine(y);
+		Word* pBoundaries = m_Boundaries.GetLine(y);
+		Word* pDirs = m_Dirs.GetLine(y);
+
+		for (int wordIdx = 0; wordIdx * WordBits < size.x; ++wordIdx)
+		{
+			const int bitCount = std::min(size.x - wordIdx * WordBits, WordBits);
+
+			// Bits past the loaded part of the row keep their value
+			Word water = 0;
+			Word dirs = 0;
+			for (int bitIdx = 0; bitIdx < bitCount; ++bitIdx)
+			{
+				const glm::ivec2 position{ wordIdx * WordBits + bitIdx, y };
+				if (pressures[position] <= 0)
+					continue;
+
+				water |= Word{ 1 } << bitIdx;
+				dirs |= static_cast<Word>(RandomBits(m_Seed, m_Step, position) & 1) << bitIdx;
+			}
+
+			const Word loaded = bitCount == WordBits ? ~Word{ 0 } : (Word{ 1 } << bitCount) - 1;
+			pWater[wordIdx] = (pWater[wordIdx] & ~loaded) | water;
+			pDirs[wordIdx] = (pDirs[wordIdx] & ~water) | dirs;
+			pBoundaries[wordIdx] &= ~water;
+		}
+
+		for (int x = 0; x < size.x; ++x)
+		{
+			if ((pWater[x / WordBits] >> (x % WordBits)) & 1)
+				m_BoundaryPlane(x, y) = false;
+		}
+	}
+	m_WaterPlaneDirty = true;
+}
+
+void NoitaBitboardWorld::LoadBoundaries(const BitmaskView& boundaries)
+{
+	// Same layout, so whole words can be copied
+	const glm::ivec2 size = glm::min(boundaries.GetSize(), m_Size);
+	const int fullWords = size.x / WordBits;
+	const int remainingBits = size.x % WordBits;
+
+	for (int y = 0; y < size.y; ++y)
+	{
+		Word* pBoundaries = m_Boundaries.GetLine(y);
+		Word* pWater = m_Water.GetLine(y);
+		const uint64_t* pLoaded = boundaries.GetRow(y);
+
+		std::copy_n(pLoaded, fullWords, pBoundaries);
+		if (remainingBits > 0)
+		{
+			const Word loaded = (Word{ 1 } << remainingBits) - 1;
+			pBoundaries[fullWords] = (pBoundaries[fullWords] & ~loaded) | (pLoaded[fullWords] & loaded);
+		}
+
+		for (int i = 0; i < m_WordCount; ++i)
+		{
+			pWater[i] &= ~pBoundaries[i];
+		}
+
+		for (int x = 0; x < size.x; ++x)
+		{
+			m_BoundaryPlane(x, y) = (pBoundaries[x / WordBits] >> (x % WordBits)) & 1;
+		}
+	}
+	m_WaterPlaneDirty = true;
+}
+
+void NoitaBitboardWorld::WriteSnapshot(SnapshotWriter& writer) const
+{
+	writer.SetWorldType("NoitaBitboardWorld");
+	writer.AddValue(m_UpdateDir);
+	writer.AddValue(m_Step);
+	writer.AddPlane(m_Water);
+	writer.AddPlane(m_Boundaries);
+	writer.AddPlane(m_Dirs);
+}
+
+bool NoitaBitboardWorld::ReadSnapshot(SnapshotReader& reader)
+{
+	if (!reader.IsWorldType("NoitaBitboardWorld"))
+		return false;
+
+	uint64_t updateDir, step;
+	if (!reader.ReadValue(updateDir) || !reader.ReadValue(step) ||
+		!reader.ReadPlanes(m_Water, m_Boundaries, m_Dirs))
+	{
+		return false;
+	}
+
+	m_UpdateDir = updateDir != 0;
+	m_Step = static_cast<uint32_t>(step);
+
+	for (int y = 0; y < m_Size.y; ++y)
+	{
+		const Word* pBoundaries = m_Boundaries.GetLine(y);
+		for (int x = 0; x < m_Size.x; ++x)
+		{
+			m_BoundaryPlane(x, y) = (pBoundaries[x / WordBits] >> (x % WordBits)) & 1;
+		}
+	}
+	m_WaterPlaneDirty = true;
+	return true;
+}
+
+void NoitaBitboardWorld::Update()
+{
+	m_StepStats.Reset();
+	m_StepStats.AddCells(static_cast<long long>(m_Size.x) * m_Size.y);
+	ScopedPhaseTimer timer(m_StepStats, "Rows");
+
+	m_UpdateDir = !m_UpdateDir;
+	++m_Step;
+
+	// NoitaWorld visits the row from left to right when m_UpdateDir is set, so cells moving
+	// right get to a contested spot first. Here that means they move first.
+	const bool firstRight = m_UpdateDir;
+
+	for (int y = 0; y < m_Size.y; ++y)
+	{
+		Word* pWater = m_Water.GetLine(y);
+		Word* pDirs = m_Dirs.GetLine(y);
+
+		if (y > 0)
+		{
+			Fall(y);
+
+			Word* pWaterBelow = m_Water.GetLine(y - 1);
+			Word* pDirsBelow = m_Dirs.GetLine(y - 1);
+			const Word* pBoundariesBelow = m_Boundaries.GetLine(y - 1);
+			MoveSideways(pWater, pDirs, pWaterBelow, pDirsBelow, pBoundariesBelow, firstRight);
+			MoveSideways(pWater, pDirs, pWaterBelow, pDirsBelow, pBoundariesBelow, !firstRight);
+		}
+
+		// Whatever is left tries to move sideways, and turns around if it can't
+		std::copy_n(pWater, m_WordCount, m_Candidates.data());
+
+		const Word* pBoundaries = m_Boundaries.GetLine(y);
+		MoveSideways(pWater, pDirs, pWater, pDirs, pBoundaries, firstRight);
+		MoveSideways(pWater, pDirs, pWater, pDirs, pBoundaries, !firstRight);
+
+		// A cell that moved left an empty spot behind, and nothing moves into a spot that was
+		// taken, so the candidates that still hold water are the ones that stayed put
+		for (int i = 0; i < m_WordCount; ++i)
+			pDirs[i] ^= m_Candidates[i] & pWater[i];
+	}
+
+	m_WaterPlaneDirty = true;
+}
+
+void NoitaBitboardWorld::Fall(int y)
+{
+	Word* pWater = m_Water.GetLine(y);
+	const Word* pDirs = m_Dirs.GetLine(y);
+	Word* pWaterBelow = m_Water.GetLine(y - 1);
+	Word* pDirsBelow = m_Dirs.GetLine(y - 1);
+	const Word* pBoundariesBelow = m_Boundaries.GetLine(y - 1);
+
+	for (int i = 0; i < m_WordCount; ++i)
+	{
+		const Word falling = pWater[i] & ~(pWaterBelow[i] | pBoundariesBelow[i]);
+
+		pWater[i] &= ~falling;
+		pWaterBelow[i] |= falling;
+		pDirsBelow[i] = (pDirsBelow[i] & ~falling) | (pDirs[i] & falling);
+	}
+}
+
+void NoitaBitboardWorld::MoveSideways(Word* pWater, Word* pDirs, Word* pTargetWater, Word* pTargetDirs, const Word* pTargetBoundaries, bool right)
+{
+	for (int i = 0; i < m_WordCount; ++i)
+	{
+		m_Empty[i] = ~(pTargetWater[i] | pTargetBoundaries[i]);
+	}
+	m_Empty[m_WordCount - 1] &= m_LastWordMask;
+
+	// Every mover has its own target, two cells moving the same way can't want the same spot
+	for (int i = 0; i < m_WordCount; ++i)
+	{
+		const Word facing = right ? pDirs[i] : ~pDirs[i];
+		const Word targetEmpty = right ? FromRight(m_Empty.data(), i, m_WordCount) : FromLeft(m_Empty.data(), i);
+		m_Movers[i] = pWater[i] & facing & targetEmpty;
+	}
+
+	for (int i = 0; i < m_WordCount; ++i)
+	{
+		const Word arriving = right ? FromLeft(m_Movers.data(), i) : FromRight(m_Movers.data(), i, m_WordCount);
+
+		pWater[i] &= ~m_Movers[i];
+		pTargetWater[i] |= arriving;
+		pTargetDirs[i] = right ? pTargetDirs[i] | arriving : pTargetDirs[i] & ~arriving;
+	}
+}
+
+void NoitaBitboardWorld::UnpackWater() const
+{
+	for (int y = 0; y < m_Size.y; ++y)
+	{
+		const Word* pWater = m_Water.GetLine(y);
+		for (int x = 0; x < m_Size.x; ++x)
+		{
+			m_WaterPlane(x, y) = (pWater[x / WordBits] >> (x % WordBits)) & 1 ? 1.f : 0.f;
+		}
+	}
+
+	m_WaterPlaneDirty = false;
+}
+
+NoitaBitboardWorld::Word NoitaBitboardWorld::FromRight(const Word* pRow, int i, int wordCount)
+{
+	return (pRow[i] >> 1) | (i + 1 < wordCount ? pRow[i + 1] << (WordBits - 1) : 0);
+}
+
+NoitaBitboardWorld::Word NoitaBitboardWorld::FromLeft(const Word* pRow, int i)
+{
+	return (pRow[i] << 1) | (i > 0 ? pRow[i - 1] >> (WordBits - 1) : 0);
+}
+
+bool NoitaBitboardWorld::IsPositionInBounds(const glm::ivec2& position) const
+{
+	return position.x >= 0 && position.x < m_Size.x &&
+		position.y >= 0 && position.y < m_Size.y;
+}
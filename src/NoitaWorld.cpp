@@ -1,8 +1,13 @@
 #include "NoitaWorld.h"
+#include "CounterRng.h"
+#include "Snapshot.h"
+
+#include <algorithm>
 
 NoitaWorld::NoitaWorld(const glm::ivec2& size)
-	: m_Cells(size.x, std::vector<CellType>(size.y, CellType::Empty))
-	, m_Dirs(size.x, std::vector<bool>(size.y, false))
+	: m_Water(size, 0)
+	, m_Boundaries(size, false)
+	, m_Dirs(size, false)
 	, m_Size(size)
 {}
 
@@ -18,63 +23,227 @@ void NoitaWorld::SetWater(const glm::ivec2& position, bool water)
 
 	if (water)
 	{
-		m_Cells[position.x][position.y] = CellType::Water;
-		m_Dirs[position.x][position.y] = rand() % 2;
+		m_Boundaries[position] = false;
+		m_Water[position] = 1;
+		m_Dirs[position] = RandomBits(m_Seed, m_Step, position) & 1;
 	}
 	else
 	{
-		if (m_Cells[position.x][position.y] == CellType::Water)
+		m_Water[position] = 0;
+	}
+
+	MarkDirty(position, position + 1);
+}
+PressureView NoitaWorld::GetPressureView() const
+{
+	return PressureView(m_Water);
+}
+
+void NoitaWorld::SetBoundary(const glm::ivec2& position, bool boundary)
+{
+	if (!IsPositionInBounds(position))
+		return;
+
+	m_Boundaries[position] = boundary;
+	if (boundary)
+		m_Water[position] = 0;
+
+	MarkDirty(position, position + 1);
+}
+BoundaryView NoitaWorld::GetBoundaryView() const
+{
+	return BoundaryView(m_Boundaries);
+}
+
+void NoitaWorld::SetWaterRegion(const Region& region, bool water)
+{
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int count = column.YEnd - column.YStart;
+
+		std::fill_n(m_Water.GetLine(x) + column.YStart, count, water ? 1.f : 0.f);
+		if (!water)
+			continue;
+
+		std::fill_n(m_Boundaries.GetLine(x) + column.YStart, count, false);
+		bool* pDirs = m_Dirs.GetLine(x);
+		for (int y = column.YStart; y < column.YEnd; ++y)
 		{
-			m_Cells[position.x][position.y] = CellType::Empty;
+			pDirs[y] = RandomBits(m_Seed, m_Step, { x, y }) & 1;
 		}
 	}
+
+	if (!region.IsEmpty())
+		MarkDirty(region.GetMin(), region.GetMax());
 }
-std::vector<std::vector<float>> NoitaWorld::GetWaterPressures() const
+
+void NoitaWorld::SetBoundaryRegion(const Region& region, bool boundary)
 {
-	std::vector<std::vector<float>> pressures(m_Size.x, std::vector<float>(m_Size.y, 0));
-	for (int x = 0; x < m_Size.x; ++x)
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
 	{
-		for (int y = 0; y < m_Size.y; ++y)
+		const Region::Column column = region.GetColumn(x);
+		const int count = column.YEnd - column.YStart;
+
+		std::fill_n(m_Boundaries.GetLine(x) + column.YStart, count, boundary);
+		if (boundary)
+			std::fill_n(m_Water.GetLine(x) + column.YStart, count, 0.f);
+	}
+
+	if (!region.IsEmpty())
+		MarkDirty(region.GetMin(), region.GetMax());
+}
+
+void NoitaWorld::LoadPressures(const PressureView& pressures)
+{
+	const glm::ivec2 size = glm::min(pressures.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pWater = m_Water.GetLine(x);
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		bool* pDirs = m_Dirs.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
 		{
-			pressures[x][y] = m_Cells[x][y] == CellType::Water ? 1 : 0;
+			// A cell holds all or nothing
+			pWater[y] = pressures(x, y) > 0 ? 1.f : 0.f;
+			if (pWater[y] == 0)
+				continue;
+
+			pBoundaries[y] = false;
+			pDirs[y] = RandomBits(m_Seed, m_Step, { x, y }) & 1;
 		}
 	}
-	return pressures;
+
+	if (size.x > 0 && size.y > 0)
+		MarkDirty({ 0, 0 }, size);
 }
 
-void NoitaWorld::SetBoundary(const glm::ivec2& position, bool boundary)
+void NoitaWorld::LoadBoundaries(const BitmaskView& boundaries)
 {
-	if (!IsPositionInBounds(position))
-		return;
+	const glm::ivec2 size = glm::min(boundaries.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pWater = m_Water.GetLine(x);
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pBoundaries[y] = boundaries(x, y);
+			if (pBoundaries[y])
+				pWater[y] = 0;
+		}
+	}
 
-	if (boundary)
+	if (size.x > 0 && size.y > 0)
+		MarkDirty({ 0, 0 }, size);
+}
+
+void NoitaWorld::WriteSnapshot(SnapshotWriter& writer) const
+{
+	writer.SetWorldType("NoitaWorld");
+	writer.AddValue(m_UpdateDir);
+	writer.AddValue(m_Step);
+	writer.AddValue(m_ParallelEnabled);
+	writer.AddPlane(m_Water);
+	writer.AddPlane(m_Boundaries);
+	writer.AddPlane(m_Dirs);
+
+	// Cells that are blocked still flip their direction, so which ones get a look matters. The
+	// chunks themselves follow from the size, only what they marked for the next step is kept.
+	if (m_ParallelEnabled)
 	{
-		m_Cells[position.x][position.y] = CellType::Boundary;
+		for (int chunkX = 0; chunkX < m_Chunks.GetWidth(); ++chunkX)
+		{
+			for (int chunkY = 0; chunkY < m_Chunks.GetHeight(); ++chunkY)
+			{
+				const Rect& nextDirty = m_Chunks(chunkX, chunkY).NextDirty;
+				for (const int coordinate : { nextDirty.Min.x, nextDirty.Min.y, nextDirty.Max.x, nextDirty.Max.y })
+				{
+					writer.AddValue(static_cast<uint32_t>(coordinate));
+				}
+			}
+		}
+		writer.AddPlane(m_Arrivals);
 	}
-	else
+}
+
+bool NoitaWorld::ReadSnapshot(SnapshotReader& reader)
+{
+	if (!reader.IsWorldType("NoitaWorld"))
+		return false;
+
+	uint64_t updateDir, step, parallel;
+	if (!reader.ReadValue(updateDir) || !reader.ReadValue(step) || !reader.ReadValue(parallel) ||
+		!reader.ReadPlanes(m_Water, m_Boundaries, m_Dirs))
+	{
+		return false;
+	}
+
+	m_UpdateDir = updateDir != 0;
+	m_Step = static_cast<uint32_t>(step);
+
+	if (m_ParallelEnabled && !(parallel && ReadChunks(reader)))
 	{
-		if (m_Cells[position.x][position.y] == CellType::Boundary)
+		// Saved by a serial world, everything gets a look like after SetParallelEnabled()
+		for (int chunkX = 0; chunkX < m_Chunks.GetWidth(); ++chunkX)
 		{
-			m_Cells[position.x][position.y] = CellType::Empty;
+			for (int chunkY = 0; chunkY < m_Chunks.GetHeight(); ++chunkY)
+			{
+				m_Chunks(chunkX, chunkY).NextDirty = m_Chunks(chunkX, chunkY).Bounds;
+			}
 		}
+		m_Arrivals.Fill(0);
 	}
+
+	return true;
 }
-std::vector<std::vector<bool>> NoitaWorld::GetBoundaries() const
+
+bool NoitaWorld::ReadChunks(SnapshotReader& reader)
 {
-	std::vector<std::vector<bool>> pressures(m_Size.x, std::vector<bool>(m_Size.y, false));
-	for (int x = 0; x < m_Size.x; ++x)
+	// Read aside first, the chunks only change once everything was read
+	std::vector<Rect> nextDirty(static_cast<size_t>(m_Chunks.GetWidth()) * m_Chunks.GetHeight());
+	for (Rect& rect : nextDirty)
 	{
-		for (int y = 0; y < m_Size.y; ++y)
+		for (int* pCoordinate : { &rect.Min.x, &rect.Min.y, &rect.Max.x, &rect.Max.y })
 		{
-			pressures[x][y] = m_Cells[x][y] == CellType::Boundary;
+			uint64_t coordinate;
+			if (!reader.ReadValue(coordinate))
+				return false;
+			*pCoordinate = static_cast<int32_t>(static_cast<uint32_t>(coordinate));
 		}
 	}
-	return pressures;
+
+	if (!reader.ReadPlanes(m_Arrivals))
+		return false;
+
+	// A chunk marks at most two cells past its edges, the cells around water that left it.
+	// Anything further out was not written by a step.
+	size_t chunk = 0;
+	for (int chunkX = 0; chunkX < m_Chunks.GetWidth(); ++chunkX)
+	{
+		for (int chunkY = 0; chunkY < m_Chunks.GetHeight(); ++chunkY)
+		{
+			Chunk& target = m_Chunks(chunkX, chunkY);
+			target.Dirty = {};
+			target.NextDirty = nextDirty[chunk++].Intersect({ target.Bounds.Min - 2, target.Bounds.Max + 2 });
+		}
+	}
+	return true;
 }
 
 void NoitaWorld::Update()
 {
+	m_StepStats.Reset();
 	m_UpdateDir = !m_UpdateDir;
+	++m_Step;
+
+	if (m_ParallelEnabled)
+	{
+		UpdateParallel();
+		return;
+	}
+
+	m_StepStats.AddCells(static_cast<long long>(m_Size.x) * m_Size.y);
+	ScopedPhaseTimer timer(m_StepStats, "Move");
 
 	for (int y = 0; y < m_Size.y; ++y)
 	{
@@ -82,46 +251,228 @@ void NoitaWorld::Update()
 			m_UpdateDir ? x < m_Size.x : x >= 0;
 			m_UpdateDir ? x++ : x--)
 		{
-			if (m_Cells[x][y] != CellType::Water)
+			if (m_Water(x, y) == 0)
 				continue;
 
-			if (IsPositionInBounds({x, y - 1}) &&
-				m_Cells[x][y - 1] == CellType::Empty)
+			MoveCell(x, y);
+		}
+	}
+}
+
+glm::ivec2 NoitaWorld::MoveCell(int x, int y)
+{
+	glm::ivec2 destination{ x, y - 1 };
+	if (!IsPositionInBounds(destination) ||
+		!IsEmpty(destination.x, destination.y))
+	{
+		const int dir = m_Dirs(x, y) ? 1 : -1;
+		destination = { x + dir, y - 1 };
+
+		if (!IsPositionInBounds(destination) ||
+			!IsEmpty(destination.x, destination.y))
+		{
+			destination = { x + dir, y };
+		}
+	}
+
+	if (IsPositionInBounds(destination) &&
+		IsEmpty(destination.x, destination.y))
+	{
+		m_Water(x, y) = 0;
+		m_Water[destination] = 1;
+		m_Dirs[destination] = m_Dirs(x, y);
+		return destination;
+	}
+
+	m_Dirs(x, y) = !m_Dirs(x, y);
+	return { x, y };
+}
+
+bool NoitaWorld::CanMove(int x, int y) const
+{
+	const int dir = m_Dirs(x, y) ? 1 : -1;
+	return (IsPositionInBounds({ x, y - 1 }) && IsEmpty(x, y - 1)) ||
+		(IsPositionInBounds({ x + dir, y - 1 }) && IsEmpty(x + dir, y - 1)) ||
+		(IsPositionInBounds({ x + dir, y }) && IsEmpty(x + dir, y));
+}
+
+void NoitaWorld::SetParallelEnabled(bool enabled, int threadCount, std::shared_ptr<WorkStealingScheduler> pScheduler)
+{
+	m_ParallelEnabled = enabled;
+	if (!enabled)
+	{
+		m_pScheduler.reset();
+		return;
+	}
+
+	m_pScheduler = pScheduler ? std::move(pScheduler) : WorkStealingScheduler::GetShared();
+	m_ThreadCount = std::min(threadCount, m_pScheduler->GetThreadCount());
+
+	const glm::ivec2 chunkCount = (m_Size + ChunkSize - 1) / ChunkSize;
+	m_Chunks = Grid2D<Chunk>(chunkCount);
+	for (int chunkX = 0; chunkX < chunkCount.x; ++chunkX)
+	{
+		for (int chunkY = 0; chunkY < chunkCount.y; ++chunkY)
+		{
+			Chunk& chunk = m_Chunks(chunkX, chunkY);
+			chunk.Bounds.Min = glm::ivec2{ chunkX, chunkY } * ChunkSize;
+			chunk.Bounds.Max = glm::min(chunk.Bounds.Min + ChunkSize, m_Size);
+
+			// Nothing is known about what happened before, so everything gets a look
+			chunk.NextDirty = chunk.Bounds;
+		}
+	}
+
+	m_Arrivals = Grid2D<uint8_t>(m_Size, 0);
+}
+
+void NoitaWorld::UpdateParallel()
+{
+	const glm::ivec2 chunkCount = m_Chunks.GetSize();
+	ScopedPhaseTimer timer(m_StepStats, "DirtyRects");
+
+	// A chunk updates whatever changed around it last step, its own changes and those of
+	// its neighbours that reached across the edge
+	for (int chunkX = 0; chunkX < chunkCount.x; ++chunkX)
+	{
+		for (int chunkY = 0; chunkY < chunkCount.y; ++chunkY)
+		{
+			Chunk& chunk = m_Chunks(chunkX, chunkY);
+			chunk.Dirty = {};
+
+			for (int neighbourX = std::max(chunkX - 1, 0); neighbourX <= std::min(chunkX + 1, chunkCount.x - 1); ++neighbourX)
 			{
-				m_Cells[x][y] = CellType::Empty;
-				m_Cells[x][y - 1] = CellType::Water;
-				m_Dirs[x][y - 1] = m_Dirs[x][y];
-				continue;
+				for (int neighbourY = std::max(chunkY - 1, 0); neighbourY <= std::min(chunkY + 1, chunkCount.y - 1); ++neighbourY)
+				{
+					chunk.Dirty.Include(m_Chunks(neighbourX, neighbourY).NextDirty.Intersect(chunk.Bounds));
+				}
 			}
+		}
+	}
+	for (int chunkX = 0; chunkX < chunkCount.x; ++chunkX)
+	{
+		for (int chunkY = 0; chunkY < chunkCount.y; ++chunkY)
+		{
+			m_Chunks(chunkX, chunkY).NextDirty = {};
+		}
+	}
 
-			const int dir = m_Dirs[x][y] ? 1 : -1;
-			if (IsPositionInBounds({ x + dir, y - 1 }) &&
-				m_Cells[x + dir][y - 1] == CellType::Empty)
+	// Chunks of the same phase are two chunks apart. Water only moves one cell, so the chunks
+	// around them that it can move into are idle and no two threads touch the same cell.
+	timer.Next("Chunks");
+	const uint8_t arrivalTag = m_UpdateDir ? 1 : 2;
+	for (int phase = 0; phase < 4; ++phase)
+	{
+		m_PhaseChunks.clear();
+		for (int chunkX = phase % 2; chunkX < chunkCount.x; chunkX += 2)
+		{
+			for (int chunkY = phase / 2; chunkY < chunkCount.y; chunkY += 2)
 			{
-				m_Cells[x][y] = CellType::Empty;
-				m_Cells[x + dir][y - 1] = CellType::Water;
-				m_Dirs[x + dir][y - 1] = m_Dirs[x][y];
-				continue;
+				const Rect& dirty = m_Chunks(chunkX, chunkY).Dirty;
+				if (dirty.IsEmpty())
+					continue;
+
+				m_PhaseChunks.push_back({ chunkX, chunkY });
+				m_StepStats.AddCells(static_cast<long long>(dirty.Max.x - dirty.Min.x) * (dirty.Max.y - dirty.Min.y));
 			}
+		}
 
-			if (IsPositionInBounds({ x + dir, y }) &&
-				m_Cells[x + dir][y] == CellType::Empty)
-			{
-				m_Cells[x][y] = CellType::Empty;
-				m_Cells[x + dir][y] = CellType::Water;
-				m_Dirs[x + dir][y] = m_Dirs[x][y];
+		m_pScheduler->Run(static_cast<int>(m_PhaseChunks.size()), [&](int task)
+		{
+			UpdateChunk(m_Chunks[m_PhaseChunks[task]], arrivalTag);
+		}, m_ThreadCount);
+	}
+
+	timer.Next(nullptr);
+	m_pScheduler->TakeThreadTimes(m_StepStats);
+}
+
+void NoitaWorld::UpdateChunk(Chunk& chunk, uint8_t arrivalTag)
+{
+	const Rect& dirty = chunk.Dirty;
+
+	// Same order as the serial update, within the chunk
+	for (int y = dirty.Min.y; y < dirty.Max.y; ++y)
+	{
+		for (int x = m_UpdateDir ? dirty.Min.x : dirty.Max.x - 1;
+			m_UpdateDir ? x < dirty.Max.x : x >= dirty.Min.x;
+			m_UpdateDir ? x++ : x--)
+		{
+			if (m_Water(x, y) == 0)
 				continue;
-			}
-			else
+
+			// Water that came in from another chunk this step has already moved
+			if (m_Arrivals(x, y) == arrivalTag)
+				continue;
+			m_Arrivals(x, y) = 0;
+
+			const glm::ivec2 position{ x, y };
+			const glm::ivec2 destination = MoveCell(x, y);
+
+			if (destination == position)
 			{
-				m_Dirs[x][y] = !m_Dirs[x][y];
+				// Turned around, only worth another look if that opened up a way out
+				if (CanMove(x, y))
+					chunk.NextDirty.Include({ position, position + 1 });
+				continue;
 			}
+
+			// The cells around both ends can move now
+			chunk.NextDirty.Include({ position - 1, position + 2 });
+			chunk.NextDirty.Include({ destination - 1, destination + 2 });
+
+			if (!chunk.Bounds.Contains(destination))
+				m_Arrivals[destination] = arrivalTag;
 		}
 	}
 }
 
+void NoitaWorld::MarkDirty(const glm::ivec2& min, const glm::ivec2& max)
+{
+	if (!m_ParallelEnabled)
+		return;
+
+	// The edited cells and the ones around them get a look next step
+	const Rect dirty{ min - 1, max + 1 };
+	const glm::ivec2 minChunk = glm::max(dirty.Min, 0) / ChunkSize;
+	const glm::ivec2 maxChunk = (glm::min(dirty.Max, m_Size) - 1) / ChunkSize;
+	for (int chunkX = minChunk.x; chunkX <= maxChunk.x; ++chunkX)
+	{
+		for (int chunkY = minChunk.y; chunkY <= maxChunk.y; ++chunkY)
+		{
+			Chunk& chunk = m_Chunks(chunkX, chunkY);
+			chunk.NextDirty.Include(dirty.Intersect(chunk.Bounds));
+		}
+	}
+
+	for (int x = min.x; x < max.x; ++x)
+	{
+		std::fill(m_Arrivals.GetLine(x) + min.y, m_Arrivals.GetLine(x) + max.y, uint8_t{ 0 });
+	}
+}
+
+void NoitaWorld::Rect::Include(const Rect& other)
+{
+	if (other.IsEmpty())
+		return;
+
+	if (IsEmpty())
+	{
+		*this = other;
+		return;
+	}
+
+	Min = glm::min(Min, other.Min);
+	Max = glm::max(Max, other.Max);
+}
+
 bool NoitaWorld::IsPositionInBounds(const glm::ivec2& position) const
 {
 	return position.x >= 0 && position.x < m_Size.x&&
 		position.y >= 0 && position.y < m_Size.y;
 }
+
+bool NoitaWorld::IsEmpty(int x, int y) const
+{
+	return m_Water(x, y) == 0 && !m_Boundaries(x, y);
+}
\ No newline at end of file
@@ -1,5 +1,11 @@
 #pragma once
 #include "World.h"
+#include "Grid2D.h"
+
+#include "WorkStealingScheduler.h"
+
+#include <cstdint>
+#include <memory>
 
 class NoitaWorld : public World
 {
@@ -8,19 +14,84 @@ public:
 	[[nodiscard]] glm::ivec2 GetSize() const override;
 
 	void SetWater(const glm::ivec2& position, bool water) override;
-	[[nodiscard]] std::vector<std::vector<float>> GetWaterPressures() const override;
+	[[nodiscard]] PressureView GetPressureView() const override;
 
 	void SetBoundary(const glm::ivec2& position, bool boundary) override;
-	[[nodiscard]] std::vector<std::vector<bool>> GetBoundaries() const override;
+	[[nodiscard]] BoundaryView GetBoundaryView() const override;
+
+	void SetWaterRegion(const Region& region, bool water) override;
+	void SetBoundaryRegion(const Region& region, bool boundary) override;
+	void LoadPressures(const PressureView& pressures) override;
+	void LoadBoundaries(const BitmaskView& boundaries) override;
 
+	void WriteSnapshot(SnapshotWriter& writer) const override;
+	[[nodiscard]] bool ReadSnapshot(SnapshotReader& reader) override;
+
+	using World::Update;
 	void Update() override;
 
+	// Updates the world in chunks spread over all cores. The chunks are done in four
+	// checkerboard phases, so water can only move into its own chunk or an idle one.
+	// Only the part of a chunk where something changed last step is updated.
+	// The chunks run on threadCount threads of the scheduler, the shared one if none is given,
+	// a thread count of 0 uses all of them.
+	void SetParallelEnabled(bool enabled, int threadCount = 0, std::shared_ptr<WorkStealingScheduler> pScheduler = nullptr);
+
 private:
-	enum class CellType { Empty, Water, Boundary };
-	std::vector<std::vector<CellType>> m_Cells;
-	std::vector<std::vector<bool>> m_Dirs;
+	struct Rect
+	{
+		glm::ivec2 Min{ 0, 0 };
+		glm::ivec2 Max{ 0, 0 };
+
+		[[nodiscard]] bool IsEmpty() const { return Min.x >= Max.x || Min.y >= Max.y; }
+		[[nodiscard]] bool Contains(const glm::ivec2& position) const
+		{
+			return position.x >= Min.x && position.x < Max.x && position.y >= Min.y && position.y < Max.y;
+		}
+		[[nodiscard]] Rect Intersect(const Rect& other) const { return { glm::max(Min, other.Min), glm::min(Max, other.Max) }; }
+		void Include(const Rect& other);
+	};
+
+	struct Chunk
+	{
+		Rect Bounds;
+		// Cells updated this step
+		Rect Dirty;
+		// Cells around what changed during this step, can reach into the neighbouring chunks
+		Rect NextDirty;
+	};
+
+	static constexpr int ChunkSize = 32;
+
+	// Moves the water at (x, y) like a falling sand cell, returns where it ended up
+	glm::ivec2 MoveCell(int x, int y);
+	bool CanMove(int x, int y) const;
+
+	void UpdateParallel();
+	// The rest of a snapshot saved in parallel mode
+	bool ReadChunks(SnapshotReader& reader);
+	void UpdateChunk(Chunk& chunk, uint8_t arrivalTag);
+	// Cells [min, max) were edited
+	void MarkDirty(const glm::ivec2& min, const glm::ivec2& max);
+
+	// A cell is water (pressure 1), boundary, or empty. Both are stored as planes
+	// so the renderer can read them directly.
+	Grid2D<float> m_Water;
+	Grid2D<bool> m_Boundaries;
+	Grid2D<bool> m_Dirs;
 	glm::ivec2 m_Size;
 	bool m_UpdateDir = false;
+	uint32_t m_Step = 0;
+
+	// Parallel mode
+	bool m_ParallelEnabled = false;
+	Grid2D<Chunk> m_Chunks;
+	// Tag of the step water moved into another chunk, so that chunk does not move it again
+	Grid2D<uint8_t> m_Arrivals;
+	std::vector<glm::ivec2> m_PhaseChunks;
+	std::shared_ptr<WorkStealingScheduler> m_pScheduler;
+	int m_ThreadCount = 0;
 
 	bool IsPositionInBounds(const glm::ivec2& position) const;
-};
\ No newline at end of file
+	bool IsEmpty(int x, int y) const;
+};
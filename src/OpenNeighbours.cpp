@@ -0,0 +1,36 @@
+#include "OpenNeighbours.h"
+
+void UpdateOpenNeighbours(Grid2D<uint8_t>& masks, const Grid2D<bool>& boundaries, const glm::ivec2& min, const glm::ivec2& max)
+{
+	const glm::ivec2 size = boundaries.GetSize();
+	const glm::ivec2 start = glm::max(min - 1, 0);
+	const glm::ivec2 end = glm::min(max + 1, size);
+
+	for (int x = start.x; x < end.x; ++x)
+	{
+		const bool* pBoundaries = boundaries.GetLine(x);
+		const bool* pLeftBoundaries = x > 0 ? boundaries.GetLine(x - 1) : nullptr;
+		const bool* pRightBoundaries = x + 1 < size.x ? boundaries.GetLine(x + 1) : nullptr;
+		uint8_t* pMasks = masks.GetLine(x);
+
+		for (int y = start.y; y < end.y; ++y)
+		{
+			if (pBoundaries[y])
+			{
+				pMasks[y] = 0;
+				continue;
+			}
+
+			uint8_t mask = 0;
+			if (y + 1 < size.y && !pBoundaries[y + 1])
+				mask |= OpenUp;
+			if (y > 0 && !pBoundaries[y - 1])
+				mask |= OpenDown;
+			if (pLeftBoundaries && !pLeftBoundaries[y])
+				mask |= OpenLeft;
+			if (pRightBoundaries && !pRightBoundaries[y])
+				mask |= OpenRight;
+			pMasks[y] = mask;
+		}
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "Grid2D.h"
+
+// For every cell, which of its four neighbours water can move to: the neighbour is in the world
+// and neither it nor the cell itself is a boundary. Kept up to date with the boundaries, the move
+// passes then test one bit instead of a bounds check and two boundary reads, and cells on the
+// edge of the world need nothing special.
+
+enum OpenNeighbour : uint8_t
+{
+	OpenUp = 1,
+	OpenDown = 2,
+	OpenLeft = 4,
+	OpenRight = 8
+};
+
+// Bit of a one cell step along an axis, 0 for no step
+[[nodiscard]] inline uint8_t GetOpenNeighbourBit(const glm::ivec2& direction)
+{
+	static constexpr uint8_t bits[3][3] = {
+		{ 0, OpenLeft, 0 },
+		{ OpenDown, 0, OpenUp },
+		{ 0, OpenRight, 0 }
+	};
+	return bits[direction.x + 1][direction.y + 1];
+}
+
+// Recomputes the masks of the cells [min, max) and of the cells next to them, which have them as a neighbour
+void UpdateOpenNeighbours(Grid2D<uint8_t>& masks, const Grid2D<bool>& boundaries, const glm::ivec2& min, const glm::ivec2& max);
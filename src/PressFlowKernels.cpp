@@ -0,0 +1,241 @@
+#include "PressFlowKernels.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "CpuFeatures.h"
+
+#ifdef CPU_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Both formulas are evaluated, so this compiles to selects instead of branches
+	template<typename Params>
+	float GetStableState(float totalPressure, const Params& params)
+	{
+		const float compressed = (params.MaxPressure * params.MaxPressure + totalPressure * params.MaxCompression)
+			/ (params.MaxPressure + params.MaxCompression);
+		const float overflowing = (totalPressure + params.MaxCompression) / 2;
+
+		const float stable = totalPressure < 2 * params.MaxPressure + params.MaxCompression ? compressed : overflowing;
+		return totalPressure <= 1 ? 1.f : stable;
+	}
+
+	// Large flows are halved to keep the water from oscillating
+	float DampFlow(float flow, float minFlow)
+	{
+		return flow > minFlow ? flow * 0.5f : flow;
+	}
+}
+
+template<typename Params>
+void ComputeFlowsScalar(const PressFlowColumn& column, int yStart, int yEnd, const Params& params)
+{
+	for (int y = yStart; y < yEnd; ++y)
+	{
+		float down = 0;
+		float left = 0;
+		float right = 0;
+		float up = 0;
+
+		const float water = column.pWater[y];
+
+		// Skip bounds and small amounts of water
+		if (!column.pBoundary[y] && water >= params.MinPressure)
+		{
+			float remaining = water;
+
+			// The block below this one
+			if (y > 0 && !column.pBoundary[y - 1])
+			{
+				const float flow = DampFlow(GetStableState(remaining + column.pWater[y - 1], params) - column.pWater[y - 1], params.MinFlow);
+				down = std::clamp(flow, 0.f, std::min(params.MaxFlow, remaining));
+				remaining -= down;
+			}
+
+			// Equalize the amount of water in this block and its neighbours
+			if (remaining > 0 && column.pWaterLeft && !column.pBoundaryLeft[y])
+			{
+				const float flow = DampFlow((water - column.pWaterLeft[y]) / 4, params.MinFlow);
+				left = std::clamp(flow, 0.f, remaining);
+				remaining -= left;
+			}
+
+			if (remaining > 0 && column.pWaterRight && !column.pBoundaryRight[y])
+			{
+				const float flow = DampFlow((water - column.pWaterRight[y]) / 4, params.MinFlow);
+				right = std::clamp(flow, 0.f, remaining);
+				remaining -= right;
+			}
+
+			// Only compressed water flows upwards
+			if (remaining > 0 && y + 1 < column.Height && !column.pBoundary[y + 1])
+			{
+				const float flow = DampFlow(remaining - GetStableState(remaining + column.pWater[y + 1], params), params.MinFlow);
+				up = std::clamp(flow, 0.f, std::min(params.MaxFlow, remaining));
+			}
+		}
+
+		column.pDown[y] = down;
+		column.pLeft[y] = left;
+		column.pRight[y] = right;
+		column.pUp[y] = up;
+	}
+}
+
+template<typename Params>
+void ComputeFlowsScalar(const PressFlowColumn& column, const Params& params)
+{
+	ComputeFlowsScalar(column, 0, column.Height, params);
+}
+
+#ifdef CPU_SSE2
+namespace
+{
+	// All bits set in the lanes whose cell is not a boundary
+	__m128 LoadOpenMask(const bool* pBoundary)
+	{
+		int32_t bytes;
+		std::memcpy(&bytes, pBoundary, sizeof(bytes));
+
+		const __m128i zero = _mm_setzero_si128();
+		__m128i lanes = _mm_cvtsi32_si128(bytes);
+		lanes = _mm_unpacklo_epi8(lanes, zero);
+		lanes = _mm_unpacklo_epi16(lanes, zero);
+		return _mm_castsi128_ps(_mm_cmpeq_epi32(lanes, zero));
+	}
+
+	__m128 Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	struct Sse2Constants
+	{
+		__m128 Zero = _mm_setzero_ps();
+		__m128 One = _mm_set1_ps(1);
+		__m128 Two = _mm_set1_ps(2);
+		__m128 Half = _mm_set1_ps(0.5f);
+		__m128 Four = _mm_set1_ps(4);
+		__m128 MaxPressureSquared;
+		__m128 MaxCompression;
+		__m128 CompressedDivisor;
+		__m128 CompressionLimit;
+		__m128 MinPressure;
+		__m128 MinFlow;
+		__m128 MaxFlow;
+
+		template<typename Params>
+		explicit Sse2Constants(const Params& params)
+			: MaxPressureSquared(_mm_set1_ps(params.MaxPressure * params.MaxPressure))
+			, MaxCompression(_mm_set1_ps(params.MaxCompression))
+			, CompressedDivisor(_mm_set1_ps(params.MaxPressure + params.MaxCompression))
+			, CompressionLimit(_mm_set1_ps(2 * params.MaxPressure + params.MaxCompression))
+			, MinPressure(_mm_set1_ps(params.MinPressure))
+			, MinFlow(_mm_set1_ps(params.MinFlow))
+			, MaxFlow(_mm_set1_ps(params.MaxFlow))
+		{}
+	};
+
+	__m128 GetStableState(__m128 totalPressure, const Sse2Constants& c)
+	{
+		const __m128 compressed = _mm_div_ps(_mm_add_ps(c.MaxPressureSquared, _mm_mul_ps(totalPressure, c.MaxCompression)), c.CompressedDivisor);
+		const __m128 overflowing = _mm_div_ps(_mm_add_ps(totalPressure, c.MaxCompression), c.Two);
+
+		const __m128 stable = Select(_mm_cmplt_ps(totalPressure, c.CompressionLimit), compressed, overflowing);
+		return Select(_mm_cmple_ps(totalPressure, c.One), c.One, stable);
+	}
+
+	// Damps and clamps a flow to [0, max], lanes outside the mask get no flow
+	__m128 FinishFlow(__m128 flow, __m128 max, __m128 mask, const Sse2Constants& c)
+	{
+		flow = Select(_mm_cmpgt_ps(flow, c.MinFlow), _mm_mul_ps(flow, c.Half), flow);
+		flow = _mm_min_ps(_mm_max_ps(flow, c.Zero), max);
+		return _mm_and_ps(mask, flow);
+	}
+}
+
+template<typename Params>
+void ComputeFlowsSse2(const PressFlowColumn& column, const Params& params)
+{
+	// The first and last row miss a neighbour, they go through the scalar kernel
+	const int vectorStart = std::min(1, column.Height);
+	const int vectorEnd = vectorStart + std::max(column.Height - 1 - vectorStart, 0) / 4 * 4;
+
+	ComputeFlowsScalar(column, 0, vectorStart, params);
+
+	const Sse2Constants c(params);
+	for (int y = vectorStart; y < vectorEnd; y += 4)
+	{
+		const __m128 water = _mm_loadu_ps(column.pWater + y);
+		const __m128 open = LoadOpenMask(column.pBoundary + y);
+		__m128 active = _mm_and_ps(open, _mm_cmpge_ps(water, c.MinPressure));
+		__m128 remaining = water;
+
+		// The block below this one
+		const __m128 below = _mm_loadu_ps(column.pWater + y - 1);
+		const __m128 down = FinishFlow(_mm_sub_ps(GetStableState(_mm_add_ps(remaining, below), c), below),
+			_mm_min_ps(c.MaxFlow, remaining), _mm_and_ps(active, LoadOpenMask(column.pBoundary + y - 1)), c);
+		remaining = _mm_sub_ps(remaining, down);
+		active = _mm_and_ps(active, _mm_cmpgt_ps(remaining, c.Zero));
+
+		// Equalize the amount of water in this block and its neighbours
+		__m128 left = c.Zero;
+		if (column.pWaterLeft)
+		{
+			left = FinishFlow(_mm_div_ps(_mm_sub_ps(water, _mm_loadu_ps(column.pWaterLeft + y)), c.Four),
+				remaining, _mm_and_ps(active, LoadOpenMask(column.pBoundaryLeft + y)), c);
+			remaining = _mm_sub_ps(remaining, left);
+			active = _mm_and_ps(active, _mm_cmpgt_ps(remaining, c.Zero));
+		}
+
+		__m128 right = c.Zero;
+		if (column.pWaterRight)
+		{
+			right = FinishFlow(_mm_div_ps(_mm_sub_ps(water, _mm_loadu_ps(column.pWaterRight + y)), c.Four),
+				remaining, _mm_and_ps(active, LoadOpenMask(column.pBoundaryRight + y)), c);
+			remaining = _mm_sub_ps(remaining, right);
+			active = _mm_and_ps(active, _mm_cmpgt_ps(remaining, c.Zero));
+		}
+
+		// Only compressed water flows upwards
+		const __m128 above = _mm_loadu_ps(column.pWater + y + 1);
+		const __m128 up = FinishFlow(_mm_sub_ps(remaining, GetStableState(_mm_add_ps(remaining, above), c)),
+			_mm_min_ps(c.MaxFlow, remaining), _mm_and_ps(active, LoadOpenMask(column.pBoundary + y + 1)), c);
+
+		_mm_storeu_ps(column.pDown + y, down);
+		_mm_storeu_ps(column.pLeft + y, left);
+		_mm_storeu_ps(column.pRight + y, right);
+		_mm_storeu_ps(column.pUp + y, up);
+	}
+
+	ComputeFlowsScalar(column, vectorEnd, column.Height, params);
+}
+#endif
+
+template<typename Params>
+ComputeFlowsFn<Params> SelectComputeFlows()
+{
+	const SimdLevel level = GetSimdLevel();
+	if (level >= SimdLevel::Avx2)
+		return ComputeFlowsAvx2<Params>;
+
+#ifdef CPU_SSE2
+	if (level >= SimdLevel::Sse2)
+		return ComputeFlowsSse2<Params>;
+#endif
+	return ComputeFlowsScalar<Params>;
+}
+
+template void ComputeFlowsScalar(const PressFlowColumn&, const PressFlowParams&);
+template void ComputeFlowsScalar(const PressFlowColumn&, const DefaultPressFlowParams&);
+template void ComputeFlowsScalar(const PressFlowColumn&, int, int, const PressFlowParams&);
+template void ComputeFlowsScalar(const PressFlowColumn&, int, int, const DefaultPressFlowParams&);
+#ifdef CPU_SSE2
+template void ComputeFlowsSse2(const PressFlowColumn&, const PressFlowParams&);
+template void ComputeFlowsSse2(const PressFlowColumn&, const DefaultPressFlowParams&);
+#endif
+template ComputeFlowsFn<PressFlowParams> SelectComputeFlows();
+template ComputeFlowsFn<DefaultPressFlowParams> SelectComputeFlows();
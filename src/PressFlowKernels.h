@@ -0,0 +1,65 @@
+#pragma once
+
+// Push-only flow of PressWorld. Every cell pushes water down, left, right and up, in that
+// order, based only on the current state. The kernels compute how much goes each way, so
+// the flows can be applied afterwards. The vectorized versions give bit-identical results
+// to the scalar one.
+
+// PressWorld's defaults as compile time constants. The kernels are instantiated for these
+// and for PressFlowParams, the instantiations for the defaults have the constants folded in.
+struct DefaultPressFlowParams
+{
+	static constexpr float MaxPressure = 1.0f;
+	static constexpr float MinPressure = 0.001f;
+	static constexpr float MaxCompression = 0.25f;
+	static constexpr float MinFlow = 0.01f;
+	static constexpr float MaxFlow = 1.25f;
+};
+
+struct PressFlowParams
+{
+	float MaxPressure = DefaultPressFlowParams::MaxPressure;
+	float MinPressure = DefaultPressFlowParams::MinPressure;
+	float MaxCompression = DefaultPressFlowParams::MaxCompression;
+	float MinFlow = DefaultPressFlowParams::MinFlow;
+	float MaxFlow = DefaultPressFlowParams::MaxFlow;
+
+	bool operator==(const PressFlowParams& other) const = default;
+};
+
+// One column of the world. The left and right pointers are null at the edge of the world.
+struct PressFlowColumn
+{
+	const float* pWater;
+	const float* pWaterLeft;
+	const float* pWaterRight;
+	const bool* pBoundary;
+	const bool* pBoundaryLeft;
+	const bool* pBoundaryRight;
+	int Height;
+
+	// Outputs, the water every cell pushes into each neighbour
+	float* pDown;
+	float* pLeft;
+	float* pRight;
+	float* pUp;
+};
+
+template<typename Params>
+using ComputeFlowsFn = void(*)(const PressFlowColumn& column, const Params& params);
+
+// Defined and instantiated in the kernel files only, so the AVX2 file never compiles its own copy of the others
+template<typename Params>
+void ComputeFlowsScalar(const PressFlowColumn& column, const Params& params);
+template<typename Params>
+void ComputeFlowsSse2(const PressFlowColumn& column, const Params& params);
+template<typename Params>
+void ComputeFlowsAvx2(const PressFlowColumn& column, const Params& params);
+
+// Flows of the rows [yStart, yEnd), the vectorized kernels use it for the first and last row
+template<typename Params>
+void ComputeFlowsScalar(const PressFlowColumn& column, int yStart, int yEnd, const Params& params);
+
+// Best kernel for the CPU the program is running on
+template<typename Params>
+[[nodiscard]] ComputeFlowsFn<Params> SelectComputeFlows();
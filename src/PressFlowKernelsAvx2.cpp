@@ -0,0 +1,131 @@
+// Compiled with AVX2 enabled, only called after SelectComputeFlows() checked the CPU.
+// Keep this file free of inline functions shared with other files, the linker could pick
+// the AVX2 copy for code that runs on any CPU.
+#include "PressFlowKernels.h"
+#include "CpuFeatures.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+
+namespace
+{
+	// All bits set in the lanes whose cell is not a boundary
+	__m256 LoadOpenMask(const bool* pBoundary)
+	{
+		const __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pBoundary)));
+		return _mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, _mm256_setzero_si256()));
+	}
+
+	struct Avx2Constants
+	{
+		__m256 Zero = _mm256_setzero_ps();
+		__m256 One = _mm256_set1_ps(1);
+		__m256 Two = _mm256_set1_ps(2);
+		__m256 Half = _mm256_set1_ps(0.5f);
+		__m256 Four = _mm256_set1_ps(4);
+		__m256 MaxPressureSquared;
+		__m256 MaxCompression;
+		__m256 CompressedDivisor;
+		__m256 CompressionLimit;
+		__m256 MinPressure;
+		__m256 MinFlow;
+		__m256 MaxFlow;
+
+		template<typename Params>
+		explicit Avx2Constants(const Params& params)
+			: MaxPressureSquared(_mm256_set1_ps(params.MaxPressure * params.MaxPressure))
+			, MaxCompression(_mm256_set1_ps(params.MaxCompression))
+			, CompressedDivisor(_mm256_set1_ps(params.MaxPressure + params.MaxCompression))
+			, CompressionLimit(_mm256_set1_ps(2 * params.MaxPressure + params.MaxCompression))
+			, MinPressure(_mm256_set1_ps(params.MinPressure))
+			, MinFlow(_mm256_set1_ps(params.MinFlow))
+			, MaxFlow(_mm256_set1_ps(params.MaxFlow))
+		{}
+	};
+
+	__m256 GetStableState(__m256 totalPressure, const Avx2Constants& c)
+	{
+		// Separate multiply and add to match the scalar kernel
+		const __m256 compressed = _mm256_div_ps(_mm256_add_ps(c.MaxPressureSquared, _mm256_mul_ps(totalPressure, c.MaxCompression)), c.CompressedDivisor);
+		const __m256 overflowing = _mm256_div_ps(_mm256_add_ps(totalPressure, c.MaxCompression), c.Two);
+
+		const __m256 stable = _mm256_blendv_ps(overflowing, compressed, _mm256_cmp_ps(totalPressure, c.CompressionLimit, _CMP_LT_OQ));
+		return _mm256_blendv_ps(stable, c.One, _mm256_cmp_ps(totalPressure, c.One, _CMP_LE_OQ));
+	}
+
+	// Damps and clamps a flow to [0, max], lanes outside the mask get no flow
+	__m256 FinishFlow(__m256 flow, __m256 max, __m256 mask, const Avx2Constants& c)
+	{
+		flow = _mm256_blendv_ps(flow, _mm256_mul_ps(flow, c.Half), _mm256_cmp_ps(flow, c.MinFlow, _CMP_GT_OQ));
+		flow = _mm256_min_ps(_mm256_max_ps(flow, c.Zero), max);
+		return _mm256_and_ps(mask, flow);
+	}
+}
+
+template<typename Params>
+void ComputeFlowsAvx2(const PressFlowColumn& column, const Params& params)
+{
+	// The first and last row miss a neighbour, they go through the scalar kernel
+	const int vectorStart = column.Height < 1 ? column.Height : 1;
+	const int interiorCount = column.Height - 1 - vectorStart;
+	const int vectorEnd = vectorStart + (interiorCount > 0 ? interiorCount / 8 * 8 : 0);
+
+	ComputeFlowsScalar(column, 0, vectorStart, params);
+
+	const Avx2Constants c(params);
+	for (int y = vectorStart; y < vectorEnd; y += 8)
+	{
+		const __m256 water = _mm256_loadu_ps(column.pWater + y);
+		const __m256 open = LoadOpenMask(column.pBoundary + y);
+		__m256 active = _mm256_and_ps(open, _mm256_cmp_ps(water, c.MinPressure, _CMP_GE_OQ));
+		__m256 remaining = water;
+
+		// The block below this one
+		const __m256 below = _mm256_loadu_ps(column.pWater + y - 1);
+		const __m256 down = FinishFlow(_mm256_sub_ps(GetStableState(_mm256_add_ps(remaining, below), c), below),
+			_mm256_min_ps(c.MaxFlow, remaining), _mm256_and_ps(active, LoadOpenMask(column.pBoundary + y - 1)), c);
+		remaining = _mm256_sub_ps(remaining, down);
+		active = _mm256_and_ps(active, _mm256_cmp_ps(remaining, c.Zero, _CMP_GT_OQ));
+
+		// Equalize the amount of water in this block and its neighbours
+		__m256 left = c.Zero;
+		if (column.pWaterLeft)
+		{
+			left = FinishFlow(_mm256_div_ps(_mm256_sub_ps(water, _mm256_loadu_ps(column.pWaterLeft + y)), c.Four),
+				remaining, _mm256_and_ps(active, LoadOpenMask(column.pBoundaryLeft + y)), c);
+			remaining = _mm256_sub_ps(remaining, left);
+			active = _mm256_and_ps(active, _mm256_cmp_ps(remaining, c.Zero, _CMP_GT_OQ));
+		}
+
+		__m256 right = c.Zero;
+		if (column.pWaterRight)
+		{
+			right = FinishFlow(_mm256_div_ps(_mm256_sub_ps(water, _mm256_loadu_ps(column.pWaterRight + y)), c.Four),
+				remaining, _mm256_and_ps(active, LoadOpenMask(column.pBoundaryRight + y)), c);
+			remaining = _mm256_sub_ps(remaining, right);
+			active = _mm256_and_ps(active, _mm256_cmp_ps(remaining, c.Zero, _CMP_GT_OQ));
+		}
+
+		// Only compressed water flows upwards
+		const __m256 above = _mm256_loadu_ps(column.pWater + y + 1);
+		const __m256 up = FinishFlow(_mm256_sub_ps(remaining, GetStableState(_mm256_add_ps(remaining, above), c)),
+			_mm256_min_ps(c.MaxFlow, remaining), _mm256_and_ps(active, LoadOpenMask(column.pBoundary + y + 1)), c);
+
+		_mm256_storeu_ps(column.pDown + y, down);
+		_mm256_storeu_ps(column.pLeft + y, left);
+		_mm256_storeu_ps(column.pRight + y, right);
+		_mm256_storeu_ps(column.pUp + y, up);
+	}
+
+	ComputeFlowsScalar(column, vectorEnd, column.Height, params);
+}
+#else
+template<typename Params>
+void ComputeFlowsAvx2(const PressFlowColumn& column, const Params& params)
+{
+	ComputeFlowsScalar(column, params);
+}
+#endif
+
+template void ComputeFlowsAvx2(const PressFlowColumn&, const PressFlowParams&);
+template void ComputeFlowsAvx2(const PressFlowColumn&, const DefaultPressFlowParams&);
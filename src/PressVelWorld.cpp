@@ -1,14 +1,46 @@
 #include "PressVelWorld.h"
-#include <SDL.h>
-#include <iostream>
+#include "CounterRng.h"
+#include "Snapshot.h"
 #include <algorithm>
-#include <execution>
+#include <type_traits>
+
+namespace
+{
+	// The parameters in the order they are stored in snapshots
+	constexpr float PressVelParams::* SnapshotParams[] = {
+		&PressVelParams::Gravity,
+		&PressVelParams::Drag,
+		&PressVelParams::VelocityMultiplier,
+		&PressVelParams::MaxPressure,
+		&PressVelParams::MinPressure,
+		&PressVelParams::MaxCompression,
+		&PressVelParams::MaxFlow,
+		&PressVelParams::FlowDueToPressure
+	};
+}
 
 PressVelWorld::PressVelWorld(const glm::ivec2& size)
-	: m_WaterCells(size.x, std::vector<WaterCell>(size.y, { {0, 0}, 0 }))
-	, m_Boundaries(size.x, std::vector<bool>(size.y, false))
+	: m_Water{ Grid2D<float>(size, 0), Grid2D<float>(size, 0), Grid2D<float>(size, 0) }
+	, m_NextWater{ Grid2D<float>(size, 0), Grid2D<float>(size, 0), Grid2D<float>(size, 0) }
+	, m_Boundaries(size, false)
+	, m_OpenNeighbours(size, 0)
+	, m_Directions(size, { 0, 0 })
 	, m_Size(size)
-{}
+	, m_Chunks((size + ChunkSize - 1) / ChunkSize)
+	, m_WetSpans(size.x)
+	, m_StepSpans(size.x)
+	, m_UpdateVelocities(SelectUpdateVelocities<VelocityParams>())
+	, m_UpdateDefaultVelocities(SelectUpdateVelocities<DefaultVelocityParams>())
+{
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, size);
+}
+
+void PressVelWorld::WaterPlanes::Swap(WaterPlanes& other)
+{
+	VelocityX.Swap(other.VelocityX);
+	VelocityY.Swap(other.VelocityY);
+	Pressure.Swap(other.Pressure);
+}
 
 glm::ivec2 PressVelWorld::GetSize() const
 {
@@ -24,27 +56,23 @@ void PressVelWorld::SetWater(const glm::ivec2& position, bool water)
 	if (water)
 	{
 		// Remove boundaries
-		m_Boundaries[position.x][position.y] = false;
-		m_WaterCells[position.x][position.y].Pressure = 1;
+		m_Boundaries(position.x, position.y) = false;
+		m_Water.Pressure(position.x, position.y) = 1;
+		m_WetSpans[position.x] = m_WetSpans[position.x].Include({ position.y, position.y + 1 });
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, position, position + 1);
 	}
 	else
 	{
-		m_WaterCells[position.x][position.y].Pressure = 0;
-		m_WaterCells[position.x][position.y].Velocity = { 0, 0 };
+		m_Water.Pressure(position.x, position.y) = 0;
+		m_Water.VelocityX(position.x, position.y) = 0;
+		m_Water.VelocityY(position.x, position.y) = 0;
 	}
 
+	WakeChunksAround(position);
 }
-std::vector<std::vector<float>> PressVelWorld::GetWaterPressures() const
+PressureView PressVelWorld::GetPressureView() const
 {
-	std::vector<std::vector<float>> pressures(m_Size.x, std::vector<float>(m_Size.y, 0));
-	for (int x = 0; x < m_Size.x; ++x)
-	{
-		for (int y = 0; y < m_Size.y; ++y)
-		{
-			pressures[x][y] = m_WaterCells[x][y].Pressure;
-		}
-	}
-	return pressures;
+	return PressureView(m_Water.Pressure);
 }
 
 void PressVelWorld::SetBoundary(const glm::ivec2& position, bool boundary)
@@ -54,54 +82,200 @@ void PressVelWorld::SetBoundary(const glm::ivec2& position, bool boundary)
 		return;
 
 	// Set State
-	m_Boundaries[position.x][position.y] = boundary;
+	m_Boundaries(position.x, position.y) = boundary;
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, position, position + 1);
+
+	WakeChunksAround(position);
+}
+BoundaryView PressVelWorld::GetBoundaryView() const
+{
+	return BoundaryView(m_Boundaries);
+}
+
+void PressVelWorld::SetWaterRegion(const Region& region, bool water)
+{
+	if (region.IsEmpty())
+		return;
+
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int count = column.YEnd - column.YStart;
+
+		std::fill_n(m_Water.Pressure.GetLine(x) + column.YStart, count, water ? 1.f : 0.f);
+		if (water)
+		{
+			std::fill_n(m_Boundaries.GetLine(x) + column.YStart, count, false);
+			m_WetSpans[x] = m_WetSpans[x].Include({ column.YStart, column.YEnd });
+		}
+		else
+		{
+			std::fill_n(m_Water.VelocityX.GetLine(x) + column.YStart, count, 0.f);
+			std::fill_n(m_Water.VelocityY.GetLine(x) + column.YStart, count, 0.f);
+		}
+	}
+
+	if (water)
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, region.GetMin(), region.GetMax());
+	WakeChunksAround(region.GetMin(), region.GetMax());
+}
+
+void PressVelWorld::SetBoundaryRegion(const Region& region, bool boundary)
+{
+	if (region.IsEmpty())
+		return;
+
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		std::fill_n(m_Boundaries.GetLine(x) + column.YStart, column.YEnd - column.YStart, boundary);
+	}
+
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, region.GetMin(), region.GetMax());
+	WakeChunksAround(region.GetMin(), region.GetMax());
+}
+
+void PressVelWorld::LoadPressures(const PressureView& pressures)
+{
+	const glm::ivec2 size = glm::min(pressures.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pPressures = m_Water.Pressure.GetLine(x);
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pPressures[y] = pressures(x, y);
+			if (pPressures[y] > 0)
+				pBoundaries[y] = false;
+		}
+
+		std::fill_n(m_Water.VelocityX.GetLine(x), size.y, 0.f);
+		std::fill_n(m_Water.VelocityY.GetLine(x), size.y, 0.f);
+	}
+
+	FindWetSpans();
+	if (size.x > 0 && size.y > 0)
+	{
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, size);
+		WakeChunksAround({ 0, 0 }, size);
+	}
+}
+
+void PressVelWorld::LoadBoundaries(const BitmaskView& boundaries)
+{
+	const glm::ivec2 size = glm::min(boundaries.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pBoundaries[y] = boundaries(x, y);
+		}
+	}
+
+	if (size.x > 0 && size.y > 0)
+	{
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, size);
+		WakeChunksAround({ 0, 0 }, size);
+	}
+}
+
+void PressVelWorld::WriteSnapshot(SnapshotWriter& writer) const
+{
+	writer.SetWorldType("PressVelWorld");
+	writer.AddValue(m_Step);
+	for (float PressVelParams::* pParam : SnapshotParams)
+	{
+		writer.AddFloat(m_Params.*pParam);
+	}
+	writer.AddPlane(m_Water.VelocityX);
+	writer.AddPlane(m_Water.VelocityY);
+	writer.AddPlane(m_Water.Pressure);
+	writer.AddPlane(m_Boundaries);
 }
-std::vector<std::vector<bool>> PressVelWorld::GetBoundaries() const
+
+bool PressVelWorld::ReadSnapshot(SnapshotReader& reader)
 {
-	return m_Boundaries;
+	if (!reader.IsWorldType("PressVelWorld"))
+		return false;
+
+	uint64_t step;
+	if (!reader.ReadValue(step))
+		return false;
+
+	// Read aside first, the world only changes once the planes were read too
+	PressVelParams params;
+	for (float PressVelParams::* pParam : SnapshotParams)
+	{
+		if (!reader.ReadFloat(params.*pParam))
+			return false;
+	}
+
+	if (!reader.ReadPlanes(m_Water.VelocityX, m_Water.VelocityY, m_Water.Pressure, m_Boundaries))
+		return false;
+
+	m_Step = static_cast<uint32_t>(step);
+	m_Params = params;
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, m_Size);
+	FindWetSpans();
+
+	// Which chunks slept is not saved, they all get a look and fall asleep again once settled
+	m_Chunks.Fill(Chunk{});
+
+	// Sleeping chunks are not copied forward, their next buffer has to match already
+	m_NextWater.VelocityX = m_Water.VelocityX;
+	m_NextWater.VelocityY = m_Water.VelocityY;
+	m_NextWater.Pressure = m_Water.Pressure;
+	return true;
 }
 
-float randFloat()
+void PressVelWorld::FindWetSpans()
 {
-	return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+	for (int x = 0; x < m_Size.x; ++x)
+	{
+		m_WetSpans[x] = RowSpan{ 0, m_Size.y }.Trim(m_Water.Pressure.GetLine(x));
+	}
 }
 
 void PressVelWorld::TransferPressure(float amount, const glm::ivec2& start, const glm::ivec2& destination)
 {
-	const glm::vec2 velocity = m_WaterCells[start.x][start.y].Velocity;
-	TransferPressure(amount, velocity, start, destination);
+	TransferPressure(amount, GetVelocity(start.x, start.y), start, destination);
 }
 void PressVelWorld::TransferPressure(float amount, const glm::vec2& velocity, const glm::ivec2& start, const glm::ivec2& destination)
 {
-	if (start == destination || amount == 0 ||
-		m_Boundaries[start.x][start.y] || m_Boundaries[destination.x][destination.y])
-	{
+	// Only called for open neighbours, neither cell is a boundary
+	if (start == destination || amount == 0)
 		return;
-	}
+
+	float& destinationPressure = m_NextWater.Pressure(destination.x, destination.y);
+	float& destinationVelocityX = m_NextWater.VelocityX(destination.x, destination.y);
+	float& destinationVelocityY = m_NextWater.VelocityY(destination.x, destination.y);
 
 	// Weighted average of velocities
-	m_NextWaterCells[destination.x][destination.y].Velocity =
-		(m_NextWaterCells[destination.x][destination.y].Velocity * m_NextWaterCells[destination.x][destination.y].Pressure
-			+ velocity * amount)
-		/ (m_NextWaterCells[destination.x][destination.y].Pressure + amount);
+	destinationVelocityX = (destinationVelocityX * destinationPressure + velocity.x * amount) / (destinationPressure + amount);
+	destinationVelocityY = (destinationVelocityY * destinationPressure + velocity.y * amount) / (destinationPressure + amount);
+
+	m_NextWater.Pressure(start.x, start.y) -= amount;
+	destinationPressure += amount;
 
-	m_NextWaterCells[start.x][start.y].Pressure -= amount;
-	m_NextWaterCells[destination.x][destination.y].Pressure += amount;
+	// Water flowing into a sleeping chunk wakes it up
+	MarkDisturbed(destination);
 }
 
-float PressVelWorld::GetStableState(float totalPressure) const
+template<typename Params>
+float PressVelWorld::GetStableState(float totalPressure, Params params)
 {
 	if (totalPressure <= 1)
 	{
 		return 1;
 	}
 
-	if (totalPressure < 2 * m_MaxPressure + m_MaxCompression)
+	if (totalPressure < 2 * params.MaxPressure + params.MaxCompression)
 	{
-		return (powf(m_MaxPressure, 2) + totalPressure * m_MaxCompression) / (m_MaxPressure + m_MaxCompression);
+		return (powf(params.MaxPressure, 2) + totalPressure * params.MaxCompression) / (params.MaxPressure + params.MaxCompression);
 	}
 
-	return (totalPressure + m_MaxCompression) / 2;
+	return (totalPressure + params.MaxCompression) / 2;
 }
 
 bool PressVelWorld::IsPositionInBounds(const glm::ivec2& position) const
@@ -110,164 +284,436 @@ bool PressVelWorld::IsPositionInBounds(const glm::ivec2& position) const
 		position.y >= 0 && position.y < m_Size.y;
 }
 
-void PressVelWorld::Update()
+template<typename Params>
+void PressVelWorld::UpdateVelocities(Params params)
+{
+	if constexpr (std::is_same_v<Params, DefaultPressVelParams>)
+		UpdateVelocities(m_UpdateDefaultVelocities, DefaultVelocityParams{});
+	else
+		UpdateVelocities(m_UpdateVelocities, VelocityParams{ params.Drag, params.Gravity, params.FlowDueToPressure, params.MinPressure });
+}
+
+template<typename KernelParams>
+void PressVelWorld::UpdateVelocities(UpdateVelocitiesFn<KernelParams> updateVelocities, const KernelParams& params)
 {
-	std::vector directions(m_Size.x, std::vector<glm::ivec2>(m_Size.y, { 0, 0 }));
-	
 	for (int x = 0; x < m_Size.x; ++x)
 	{
-		for (int y = 0; y < m_Size.y; ++y)
+		const bool hasLeft = x > 0;
+		const bool hasRight = x + 1 < m_Size.x;
+		const VelocityColumn column{
+			m_Water.VelocityX.GetLine(x),
+			m_Water.VelocityY.GetLine(x),
+			m_Water.Pressure.GetLine(x),
+			hasLeft ? m_Water.Pressure.GetLine(x - 1) : nullptr,
+			hasRight ? m_Water.Pressure.GetLine(x + 1) : nullptr,
+			m_Boundaries.GetLine(x),
+			hasLeft ? m_Boundaries.GetLine(x - 1) : nullptr,
+			hasRight ? m_Boundaries.GetLine(x + 1) : nullptr,
+			m_Size.y
+		};
+
+		// Dry cells next to the water too, their velocity is averaged into the water arriving there
+		const RowSpan rows = m_StepSpans[x];
+		for (int chunkY = rows.Start / ChunkSize; !rows.IsEmpty() && chunkY <= (rows.End - 1) / ChunkSize; ++chunkY)
 		{
-			// Drag
-			m_WaterCells[x][y].Velocity = m_WaterCells[x][y].Velocity * (1 - m_Drag);
-
-			// Gravity
-			m_WaterCells[x][y].Velocity.y += m_Gravity;
+			if (!m_Chunks(x / ChunkSize, chunkY).Awake)
+				continue;
 
-			// Wind
-			//m_WaterCells[x][y].Velocity.x += 0.1f;
+			const RowSpan chunkRows = rows.Clip(chunkY * ChunkSize, (chunkY + 1) * ChunkSize);
+			AddActivity({ x, chunkRows.Start }, updateVelocities(column, chunkRows.Start, chunkRows.End, params));
+		}
+	}
+}
 
-			// Pressure Diff
-			if (m_Boundaries[x][y])
+template<typename Params>
+void PressVelWorld::SampleDirections(Params params)
+{
+	for (int x = 0; x < m_Size.x; ++x)
+	{
+		// Only water moves, the directions of the dry cells are never read
+		const RowSpan rows = m_WetSpans[x];
+		for (int chunkY = rows.Start / ChunkSize; !rows.IsEmpty() && chunkY <= (rows.End - 1) / ChunkSize; ++chunkY)
+		{
+			if (!m_Chunks(x / ChunkSize, chunkY).Awake)
 				continue;
 
-			const float pressureAtPos = m_WaterCells[x][y].Pressure;
+			const RowSpan chunkRows = rows.Clip(chunkY * ChunkSize, (chunkY + 1) * ChunkSize);
+			for (int y = chunkRows.Start; y < chunkRows.End; ++y)
+			{
+				glm::ivec2& direction = m_Directions(x, y);
+				direction = { 0, 0 };
 
-			if (IsPositionInBounds({ x, y + 1 }) && !m_Boundaries[x][y + 1])
-				m_WaterCells[x][y].Velocity += glm::vec2{ 0, 1 } *(pressureAtPos - m_WaterCells[x][y + 1].Pressure) * m_FlowDueToPressure;
+				if (m_Boundaries(x, y))
+					continue;
 
-			if (IsPositionInBounds({ x, y - 1 }) && !m_Boundaries[x][y - 1])
-				m_WaterCells[x][y].Velocity += glm::vec2{ 0, -1 } *(pressureAtPos - m_WaterCells[x][y - 1].Pressure) * m_FlowDueToPressure;
+				// Wanted direction
+				const glm::vec2 velocity = GetVelocity(x, y);
+				if (m_Water.Pressure(x, y) == 0 || velocity == glm::vec2{ 0, 0 })
+					continue;
 
-			if (IsPositionInBounds({ x + 1, y }) && !m_Boundaries[x + 1][y])
-				m_WaterCells[x][y].Velocity += glm::vec2{ 1, 0 } *(pressureAtPos - m_WaterCells[x + 1][y].Pressure) * m_FlowDueToPressure;
+				float xSize = abs(velocity.x);
+				const float ySize = abs(velocity.y);
+				const float total = xSize + ySize;
+				xSize /= total;
 
-			if (IsPositionInBounds({ x - 1, y }) && !m_Boundaries[x - 1][y])
-				m_WaterCells[x][y].Velocity += glm::vec2{ -1, 0 } *(pressureAtPos - m_WaterCells[x - 1][y].Pressure) * m_FlowDueToPressure;
+				if (RandomFloat(m_Seed, m_Step, { x, y }, 0) <= xSize)
+					direction.x = (RandomFloat(m_Seed, m_Step, { x, y }, 1) < xSize * params.VelocityMultiplier) * glm::sign(velocity.x);
+				else
+					direction.y = (RandomFloat(m_Seed, m_Step, { x, y }, 1) < ySize * params.VelocityMultiplier) * glm::sign(velocity.y);
+			}
+		}
+	}
+}
 
-			// Wanted direction
-			if (m_WaterCells[x][y].Pressure == 0 || m_WaterCells[x][y].Velocity == glm::vec2{ 0, 0 })
-				continue;
+glm::vec2 PressVelWorld::GetVelocity(int x, int y) const
+{
+	return { m_Water.VelocityX(x, y), m_Water.VelocityY(x, y) };
+}
 
-			float xSize = abs(m_WaterCells[x][y].Velocity.x);
-			const float ySize = abs(m_WaterCells[x][y].Velocity.y);
-			const float total = xSize + ySize;
-			xSize /= total;
+template<typename Params>
+void PressVelWorld::Step(Params params)
+{
+	m_StepStats.Reset();
+	ScopedPhaseTimer timer(m_StepStats, "Velocities");
+	++m_Step;
 
-			if (randFloat() <= xSize)
-				directions[x][y].x = (randFloat() < xSize * m_VelocityMultiplier) * glm::sign(m_WaterCells[x][y].Velocity.x);
-			else
-				directions[x][y].y = (randFloat() < ySize * m_VelocityMultiplier) * glm::sign(m_WaterCells[x][y].Velocity.y);
-		}
+	// Water moves one cell per step at most, only the wet rows and the cells next to them change
+	for (int x = 0; x < m_Size.x; ++x)
+	{
+		RowSpan rows = m_WetSpans[x].Grow(m_Size.y);
+		if (x > 0)
+			rows = rows.Include(m_WetSpans[x - 1]);
+		if (x + 1 < m_Size.x)
+			rows = rows.Include(m_WetSpans[x + 1]);
+		m_StepSpans[x] = rows;
 	}
-	
-	// Move cells to fill wanted direction
-	m_NextWaterCells = m_WaterCells;
+
+	UpdateVelocities(params);
+	timer.Next("Directions");
+	SampleDirections(params);
+	timer.Next("Move");
+
+	// Move cells to fill wanted direction.
+	// The next buffer has to match the current one wherever the move pass can write. Flow only
+	// reaches the neighbouring columns, so each column is copied over just before the column to
+	// its left is processed. Sleeping chunks already match, see UpdateChunkStates().
+	if (m_Size.x > 0)
+		CopyColumnForward(0);
 
 	for (int x = 0; x < m_Size.x; ++x)
 	{
-		for (int y = 0; y < m_Size.y; ++y)
+		if (x + 1 < m_Size.x)
+			CopyColumnForward(x + 1);
+
+		const RowSpan rows = m_WetSpans[x];
+		for (int chunkY = rows.Start / ChunkSize; !rows.IsEmpty() && chunkY <= (rows.End - 1) / ChunkSize; ++chunkY)
 		{
-			if (m_WaterCells[x][y].Pressure < m_MinPressure)
+			if (!m_Chunks(x / ChunkSize, chunkY).Awake)
 				continue;
 
-			const auto dir = directions[x][y];
-			if (dir == glm::ivec2{ 0, 0 })
-				continue;
+			const RowSpan chunkRows = rows.Clip(chunkY * ChunkSize, (chunkY + 1) * ChunkSize);
+			m_StepStats.AddCells(chunkRows.End - chunkRows.Start);
+			for (int y = chunkRows.Start; y < chunkRows.End; ++y)
+			{
+				if (m_Water.Pressure(x, y) < params.MinPressure)
+					continue;
 
-			// Custom push-only flow
-			float remainingPressure = m_WaterCells[x][y].Pressure;
+				const auto dir = m_Directions(x, y);
+				if (dir == glm::ivec2{ 0, 0 })
+					continue;
 
-			// Wanted direction
-			if (IsPositionInBounds(glm::ivec2{ x, y } + dir) &&
-				!m_Boundaries[x][y] && !m_Boundaries[x + dir.x][y + dir.y])
-			{
-				float flow;
+				// Custom push-only flow
+				float remainingPressure = m_Water.Pressure(x, y);
+				const uint8_t open = m_OpenNeighbours(x, y);
+				const bool wantedOpen = open & GetOpenNeighbourBit(dir);
 
-				if (IsPositionInBounds(glm::ivec2{ x, y } + dir + glm::ivec2{0, 1}) && !m_Boundaries[x + dir.x][y + dir.y + 1])
+				// Wanted direction
+				if (wantedOpen)
 				{
-					flow = GetStableState(m_WaterCells[x + dir.x][y + dir.y].Pressure + m_WaterCells[x + dir.x][y + dir.y + 1].Pressure)
-						- m_WaterCells[x + dir.x][y + dir.y].Pressure;
+					float flow;
+
+					if (m_OpenNeighbours(x + dir.x, y + dir.y) & OpenUp)
+					{
+						flow = GetStableState(m_Water.Pressure(x + dir.x, y + dir.y) + m_Water.Pressure(x + dir.x, y + dir.y + 1), params)
+							- m_Water.Pressure(x + dir.x, y + dir.y);
+					}
+					else
+					{
+						flow = 1 - m_Water.Pressure(x + dir.x, y + dir.y);
+					}
+					flow = glm::clamp(flow, 0.f, std::min(params.MaxFlow, remainingPressure));
+
+					TransferPressure(flow, { x, y }, { x + dir.x, y + dir.y });
+					remainingPressure -= flow;
+
+					if (remainingPressure <= 0)
+						continue;
 				}
-				else
+
+				// Give velocity to wanteddir cell in proportion to remaining
+				if (wantedOpen)
 				{
-					flow = 1 - m_WaterCells[x + dir.x][y + dir.y].Pressure;
+					const glm::vec2 velocity = GetVelocity(x + dir.x, y + dir.y) + GetVelocity(x, y) * remainingPressure
+						/ m_Water.Pressure(x + dir.x, y + dir.y);
+					m_Water.VelocityX(x + dir.x, y + dir.y) = velocity.x;
+					m_Water.VelocityY(x + dir.x, y + dir.y) = velocity.y;
+					MarkDisturbed({ x + dir.x, y + dir.y });
 				}
-				flow = glm::clamp(flow, 0.f, std::min(m_MaxFlow, remainingPressure));
 
-				TransferPressure(flow, { x, y }, { x + dir.x, y + dir.y });
-				remainingPressure -= flow;
+				// Left
+				if (open & GetOpenNeighbourBit({ dir.y, -dir.x })) {
+					//Equalize the amount of water in this block and it's neighbour
+					float flow = (m_Water.Pressure(x, y) - m_Water.Pressure(x + dir.y, y - dir.x)) / 4;
+					flow = glm::clamp(flow, 0.f, remainingPressure);
 
-				if (remainingPressure <= 0)
-					continue;
+					glm::vec2 vel = glm::vec2{ dir.y, -dir.x } *0.5f * GetVelocity(x, y);
+					TransferPressure(flow, vel, { x, y }, { x + dir.y, y - dir.x });
+					remainingPressure -= flow;
+
+					if (remainingPressure <= 0)
+						continue;
+				}
+
+				// Right
+				if (open & GetOpenNeighbourBit({ -dir.y, dir.x })) {
+					//Equalize the amount of water in this block and it's neighbour
+					float flow = (m_Water.Pressure(x, y) - m_Water.Pressure(x - dir.y, y + dir.x)) / 4;
+					flow = glm::clamp(flow, 0.f, remainingPressure);
+
+					glm::vec2 vel = glm::vec2{ -dir.y, dir.x } *0.5f * GetVelocity(x, y);
+					TransferPressure(flow, vel, { x, y }, { x - dir.y, y + dir.x });
+					remainingPressure -= flow;
+
+					if (remainingPressure <= 0)
+						continue;
+				}
+
+				// Up
+				if (open & OpenUp) {
+					float flow = remainingPressure - GetStableState(remainingPressure + m_Water.Pressure(x, y + 1), params);
+					flow = glm::clamp(flow, 0.f, std::min(params.MaxFlow, remainingPressure));
+
+					const auto vel = glm::vec2{ m_Water.VelocityX(x, y), 0.5f };
+					TransferPressure(flow, vel, { x, y }, { x, y + 1 });
+					remainingPressure -= flow;
+				}
 			}
+		}
+	}
 
-			// Give velocity to wanteddir cell in proportion to remaining
-			if (IsPositionInBounds(glm::ivec2{ x, y } + dir) &&
-				!m_Boundaries[x][y] && !m_Boundaries[x + dir.x][y + dir.y])
+	timer.Next("Activity");
+
+	// Net pressure change, transfers back and forth between settled cells cancel out
+	for (int x = 0; x < m_Size.x; ++x)
+	{
+		const RowSpan rows = m_StepSpans[x];
+		for (int chunkY = rows.Start / ChunkSize; !rows.IsEmpty() && chunkY <= (rows.End - 1) / ChunkSize; ++chunkY)
+		{
+			if (!m_Chunks(x / ChunkSize, chunkY).Awake)
+				continue;
+
+			const RowSpan chunkRows = rows.Clip(chunkY * ChunkSize, (chunkY + 1) * ChunkSize);
+			for (int y = chunkRows.Start; y < chunkRows.End; ++y)
 			{
-				m_WaterCells[x + dir.x][y + dir.y].Velocity += m_WaterCells[x][y].Velocity * remainingPressure
-					/ m_WaterCells[x + dir.x][y + dir.y].Pressure;
+				AddActivity({ x, y }, abs(m_NextWater.Pressure(x, y) - m_Water.Pressure(x, y)));
 			}
+		}
+	}
 
-			// Left
-			if (IsPositionInBounds(glm::ivec2{ x + dir.y, y - dir.x }) &&
-				!m_Boundaries[x][y] && !m_Boundaries[x + dir.y][y - dir.x]) {
-				//Equalize the amount of water in this block and it's neighbour
-				float flow = (m_WaterCells[x][y].Pressure - m_WaterCells[x + dir.y][y - dir.x].Pressure) / 4;
-				flow = glm::clamp(flow, 0.f, remainingPressure);
+	m_Water.Swap(m_NextWater);
 
-				glm::vec2 vel = glm::vec2{ dir.y, -dir.x } *0.5f * m_WaterCells[x][y].Velocity;
-				TransferPressure(flow, vel, { x, y }, { x + dir.y, y - dir.x });
-				remainingPressure -= flow;
+	// Make everything valid
+	timer.Next("Validate");
+	for (int chunkX = 0; chunkX < m_Chunks.GetWidth(); ++chunkX)
+	{
+		for (int chunkY = 0; chunkY < m_Chunks.GetHeight(); ++chunkY)
+		{
+			const Chunk& chunk = m_Chunks(chunkX, chunkY);
+			if (!chunk.Awake && !chunk.Disturbed)
+				continue;
 
-				if (remainingPressure <= 0)
-					continue;
+			const int xEnd = std::min((chunkX + 1) * ChunkSize, m_Size.x);
+			const int yStart = chunkY * ChunkSize;
+			for (int x = chunkX * ChunkSize; x < xEnd; ++x)
+			{
+				// Outside the rows of the step the velocities are already 0 and nothing is wet
+				const RowSpan rows = m_StepSpans[x].Clip(yStart, yStart + ChunkSize);
+				float* pPressures = m_Water.Pressure.GetLine(x);
+				float* pVelocitiesX = m_Water.VelocityX.GetLine(x);
+				float* pVelocitiesY = m_Water.VelocityY.GetLine(x);
+				const bool* pBoundaries = m_Boundaries.GetLine(x);
+				for (int y = rows.Start; y < rows.End; ++y)
+				{
+					if (pBoundaries[y])
+						pPressures[y] = 0;
+
+					if (pBoundaries[y] || pPressures[y] < params.MinPressure)
+					{
+						pVelocitiesX[y] = 0;
+						pVelocitiesY[y] = 0;
+					}
+				}
 			}
+		}
+	}
 
-			// Right
-			if (IsPositionInBounds(glm::ivec2{ x - dir.y, y + dir.x }) &&
-				!m_Boundaries[x][y] && !m_Boundaries[x - dir.y][y + dir.x]) {
-				//Equalize the amount of water in this block and it's neighbour
-				float flow = (m_WaterCells[x][y].Pressure - m_WaterCells[x - dir.y][y + dir.x].Pressure) / 4;
-				flow = glm::clamp(flow, 0.f, remainingPressure);
+	// Everything that got wet is within the rows of the step
+	for (int x = 0; x < m_Size.x; ++x)
+	{
+		m_WetSpans[x] = m_StepSpans[x].Trim(m_Water.Pressure.GetLine(x));
+	}
 
-				glm::vec2 vel = glm::vec2{ -dir.y, dir.x } *0.5f * m_WaterCells[x][y].Velocity;
-				TransferPressure(flow, vel, { x, y }, { x - dir.y, y + dir.x });
-				remainingPressure -= flow;
+	timer.Next("ChunkStates");
+	UpdateChunkStates();
+}
 
-				if (remainingPressure <= 0)
-					continue;
-			}
+void PressVelWorld::Update()
+{
+#ifndef CA_GENERIC_PARAMS
+	if (m_Params == PressVelParams{})
+	{
+		Step(DefaultPressVelParams{});
+		return;
+	}
+#endif
 
-			// Up
-			if (IsPositionInBounds(glm::ivec2{ x, y + 1 }) &&
-				!m_Boundaries[x][y] && !m_Boundaries[x][y + 1]) {
-				float flow = remainingPressure - GetStableState(remainingPressure + m_WaterCells[x][y + 1].Pressure);
-				flow = glm::clamp(flow, 0.f, std::min(m_MaxFlow, remainingPressure));
+	Step(m_Params);
+}
 
-				const auto vel = glm::vec2{ m_WaterCells[x][y].Velocity.x, 0.5f };
-				TransferPressure(flow, vel, { x, y }, { x, y + 1 });
-				remainingPressure -= flow;
-			}
+void PressVelWorld::CopyColumnForward(int x)
+{
+	ScopedPhaseTimer timer(m_StepStats, "Move/Copy");
+
+	for (int chunkY = 0; chunkY < m_Chunks.GetHeight(); ++chunkY)
+	{
+		if (!m_Chunks(x / ChunkSize, chunkY).Awake)
+			continue;
+
+		const int yStart = chunkY * ChunkSize;
+		CopyForward(x, yStart, std::min(yStart + ChunkSize, m_Size.y));
+	}
+}
+
+void PressVelWorld::CopyForward(int x, int yStart, int yEnd)
+{
+	const int count = yEnd - yStart;
+	std::copy_n(m_Water.VelocityX.GetLine(x) + yStart, count, m_NextWater.VelocityX.GetLine(x) + yStart);
+	std::copy_n(m_Water.VelocityY.GetLine(x) + yStart, count, m_NextWater.VelocityY.GetLine(x) + yStart);
+	std::copy_n(m_Water.Pressure.GetLine(x) + yStart, count, m_NextWater.Pressure.GetLine(x) + yStart);
+}
+
+void PressVelWorld::SetSleepingEnabled(bool enabled)
+{
+	m_SleepingEnabled = enabled;
+	if (!enabled)
+	{
+		m_Chunks.Fill(Chunk{});
+	}
+}
+
+void PressVelWorld::SetParams(const PressVelParams& params)
+{
+	m_Params = params;
+
+	// Water that settled with the old parameters may not be settled with the new ones
+	m_Chunks.Fill(Chunk{});
+}
+
+const PressVelParams& PressVelWorld::GetParams() const
+{
+	return m_Params;
+}
+
+void PressVelWorld::WakeChunksAround(const glm::ivec2& position)
+{
+	WakeChunksAround(position, position + 1);
+}
+
+void PressVelWorld::WakeChunksAround(const glm::ivec2& min, const glm::ivec2& max)
+{
+	// Edits also change the flow into the neighbouring cells, which can be in another chunk
+	const glm::ivec2 minChunk = glm::max(min - 1, 0) / ChunkSize;
+	const glm::ivec2 maxChunk = glm::min(max, m_Size - 1) / ChunkSize;
+	for (int chunkX = minChunk.x; chunkX <= maxChunk.x; ++chunkX)
+	{
+		for (int chunkY = minChunk.y; chunkY <= maxChunk.y; ++chunkY)
+		{
+			m_Chunks(chunkX, chunkY).Awake = true;
+			m_Chunks(chunkX, chunkY).QuietSteps = 0;
 		}
 	}
+}
 
-	m_WaterCells = m_NextWaterCells;
+void PressVelWorld::MarkDisturbed(const glm::ivec2& position)
+{
+	Chunk& chunk = m_Chunks(position.x / ChunkSize, position.y / ChunkSize);
+	if (!chunk.Awake)
+		chunk.Disturbed = true;
+}
 
-	// Make everything valid
-	for (int y = 0; y < m_Size.y; ++y)
+void PressVelWorld::AddActivity(const glm::ivec2& position, float amount)
+{
+	Chunk& chunk = m_Chunks(position.x / ChunkSize, position.y / ChunkSize);
+	chunk.Activity = std::max(chunk.Activity, amount);
+}
+
+void PressVelWorld::UpdateChunkStates()
+{
+	if (!m_SleepingEnabled)
+	{
+		m_Chunks.Fill(Chunk{});
+		return;
+	}
+
+	const glm::ivec2 chunkCount = m_Chunks.GetSize();
+
+	// Active chunks keep their neighbours awake, water can flow across the chunk edge
+	for (int chunkX = 0; chunkX < chunkCount.x; ++chunkX)
 	{
-		for (int x = 0; x < m_Size.x; ++x)
+		for (int chunkY = 0; chunkY < chunkCount.y; ++chunkY)
 		{
-			if (m_Boundaries[x][y])
+			const Chunk& chunk = m_Chunks(chunkX, chunkY);
+			if (chunk.Activity <= m_SleepThreshold && !chunk.Disturbed)
+				continue;
+
+			for (int neighbourX = std::max(chunkX - 1, 0); neighbourX <= std::min(chunkX + 1, chunkCount.x - 1); ++neighbourX)
 			{
-				m_WaterCells[x][y].Velocity = { 0, 0 };
-				m_WaterCells[x][y].Pressure = 0;
+				for (int neighbourY = std::max(chunkY - 1, 0); neighbourY <= std::min(chunkY + 1, chunkCount.y - 1); ++neighbourY)
+				{
+					m_Chunks(neighbourX, neighbourY).QuietSteps = 0;
+				}
 			}
+		}
+	}
+
+	for (int chunkX = 0; chunkX < chunkCount.x; ++chunkX)
+	{
+		for (int chunkY = 0; chunkY < chunkCount.y; ++chunkY)
+		{
+			Chunk& chunk = m_Chunks(chunkX, chunkY);
+			if (chunk.QuietSteps == 0)
+			{
+				chunk.Awake = true;
+			}
+			else if (chunk.Awake && chunk.QuietSteps >= m_StepsBeforeSleep)
+			{
+				chunk.Awake = false;
+
+				// Nothing writes to a sleeping chunk, so once both buffers match they keep matching
+				const int xEnd = std::min((chunkX + 1) * ChunkSize, m_Size.x);
+				const int yStart = chunkY * ChunkSize;
+				const int yEnd = std::min(yStart + ChunkSize, m_Size.y);
+				for (int x = chunkX * ChunkSize; x < xEnd; ++x)
+				{
+					CopyForward(x, yStart, yEnd);
+				}
+			}
+
+			if (chunk.Awake)
+				++chunk.QuietSteps;
 
-			if (m_WaterCells[x][y].Pressure < m_MinPressure)
-				m_WaterCells[x][y].Velocity = { 0, 0 };
+			chunk.Activity = 0;
+			chunk.Disturbed = false;
 		}
 	}
 }
\ No newline at end of file
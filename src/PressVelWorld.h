@@ -1,46 +1,147 @@
 #pragma once
 #include "World.h"
+#include "Grid2D.h"
+#include "VelocityKernels.h"
+#include "OpenNeighbours.h"
+#include "RowSpan.h"
+
+#include <vector>
+
+// Constants of the simulation, can be changed at runtime to experiment with them
+struct PressVelParams
+{
+	float Gravity = DefaultVelocityParams::Gravity;
+	float Drag = DefaultVelocityParams::Drag;
+	float VelocityMultiplier = 1.f;
+
+	float MaxPressure = 1.0f;
+	float MinPressure = DefaultVelocityParams::MinPressure;
+	float MaxCompression = 0.25f;
+	float MaxFlow = 1.25f;
+	float FlowDueToPressure = DefaultVelocityParams::FlowDueToPressure;
+
+	bool operator==(const PressVelParams& other) const = default;
+};
+
+// The default constants known at compile time. Steps with the default parameters run a copy of the
+// solver specialized on these, so the constants fold into its inner loops.
+struct DefaultPressVelParams
+{
+	static constexpr float Gravity = PressVelParams{}.Gravity;
+	static constexpr float Drag = PressVelParams{}.Drag;
+	static constexpr float VelocityMultiplier = PressVelParams{}.VelocityMultiplier;
+
+	static constexpr float MaxPressure = PressVelParams{}.MaxPressure;
+	static constexpr float MinPressure = PressVelParams{}.MinPressure;
+	static constexpr float MaxCompression = PressVelParams{}.MaxCompression;
+	static constexpr float MaxFlow = PressVelParams{}.MaxFlow;
+	static constexpr float FlowDueToPressure = PressVelParams{}.FlowDueToPressure;
+};
 
 class PressVelWorld : public World
 {
 public:
-	struct WaterCell
-	{
-		glm::vec2 Velocity;
-		float Pressure;
-	};
-
 	PressVelWorld(const glm::ivec2& size);
 	[[nodiscard]] glm::ivec2 GetSize() const override;
 
 	void SetWater(const glm::ivec2& position, bool water) override;
-	[[nodiscard]] std::vector<std::vector<float>> GetWaterPressures() const override;
+	[[nodiscard]] PressureView GetPressureView() const override;
 
 	void SetBoundary(const glm::ivec2& position, bool boundary) override;
-	[[nodiscard]] std::vector<std::vector<bool>> GetBoundaries() const override;
+	[[nodiscard]] BoundaryView GetBoundaryView() const override;
+
+	void SetWaterRegion(const Region& region, bool water) override;
+	void SetBoundaryRegion(const Region& region, bool boundary) override;
+	void LoadPressures(const PressureView& pressures) override;
+	void LoadBoundaries(const BitmaskView& boundaries) override;
 
+	void WriteSnapshot(SnapshotWriter& writer) const override;
+	[[nodiscard]] bool ReadSnapshot(SnapshotReader& reader) override;
+
+	using World::Update;
 	void Update() override;
 
+	// Chunks whose water has settled are skipped until something disturbs them
+	void SetSleepingEnabled(bool enabled);
+
+	void SetParams(const PressVelParams& params);
+	[[nodiscard]] const PressVelParams& GetParams() const;
+
 private:
+	// Water is stored as separate planes, so the velocity kernel can stream through them
+	struct WaterPlanes
+	{
+		Grid2D<float> VelocityX;
+		Grid2D<float> VelocityY;
+		Grid2D<float> Pressure;
+
+		void Swap(WaterPlanes& other);
+	};
+
+	struct Chunk
+	{
+		bool Awake = true;
+		bool Disturbed = false;
+		int QuietSteps = 0;
+		float Activity = 0;
+	};
+
+	static constexpr int ChunkSize = 16;
+
+	void WakeChunksAround(const glm::ivec2& position);
+	// Wakes the chunks around the cells [min, max)
+	void WakeChunksAround(const glm::ivec2& min, const glm::ivec2& max);
+	void UpdateChunkStates();
+	void MarkDisturbed(const glm::ivec2& position);
+	void AddActivity(const glm::ivec2& position, float amount);
+	void CopyColumnForward(int x);
+	void CopyForward(int x, int yStart, int yEnd);
+	// After the water was changed without keeping the spans up to date
+	void FindWetSpans();
+
+	// One step with the parameters either as PressVelParams or as DefaultPressVelParams
+	template<typename Params>
+	void Step(Params params);
+
+	template<typename Params>
+	void UpdateVelocities(Params params);
+	template<typename KernelParams>
+	void UpdateVelocities(UpdateVelocitiesFn<KernelParams> updateVelocities, const KernelParams& params);
+	template<typename Params>
+	void SampleDirections(Params params);
+	[[nodiscard]] glm::vec2 GetVelocity(int x, int y) const;
+
 	void TransferPressure(float amount, const glm::ivec2& start, const glm::ivec2& destination);
 	void TransferPressure(float amount, const glm::vec2& velocity, const glm::ivec2& start, const glm::ivec2& destination);
 
-	float GetStableState(float totalPressure) const;
+	template<typename Params>
+	static float GetStableState(float totalPressure, Params params);
 
 	bool IsPositionInBounds(const glm::ivec2& position) const;
 
-	std::vector<std::vector<WaterCell>> m_WaterCells;
-	std::vector<std::vector<WaterCell>> m_NextWaterCells;
-	std::vector<std::vector<bool>> m_Boundaries;
+	WaterPlanes m_Water;
+	WaterPlanes m_NextWater;
+	Grid2D<bool> m_Boundaries;
+	// See OpenNeighbours.h, updated whenever the boundaries change
+	Grid2D<uint8_t> m_OpenNeighbours;
+	Grid2D<glm::ivec2> m_Directions;
 	glm::ivec2 m_Size;
+	uint32_t m_Step = 0;
+
+	Grid2D<Chunk> m_Chunks;
+	bool m_SleepingEnabled = true;
+
+	// See RowSpan.h, every cell holding water is in the wet span of its column
+	std::vector<RowSpan> m_WetSpans;
+	// Rows a step visits: the wet rows of the column and of its neighbours, and one more above and below
+	std::vector<RowSpan> m_StepSpans;
+
+	// Picked once for the CPU we are running on
+	UpdateVelocitiesFn<VelocityParams> m_UpdateVelocities;
+	UpdateVelocitiesFn<DefaultVelocityParams> m_UpdateDefaultVelocities;
 
-	const float m_Gravity = -0.1f;
-	const float m_Drag = 0.1f;
-	const float m_VelocityMultiplier = 1.f;
+	PressVelParams m_Params;
 
-	const float m_MaxPressure = 1.0f;
-	const float m_MinPressure = 0.001f;
-	const float m_MaxCompression = 0.25f;
-	const float m_MaxFlow = 1.25f;
-	const float m_FlowDueToPressure = 0.05f;
+	const float m_SleepThreshold = 0.001f;
+	const int m_StepsBeforeSleep = 30;
 };
\ No newline at end of file
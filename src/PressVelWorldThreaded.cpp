@@ -1,202 +1,41 @@
 #include "PressVelWorldThreaded.h"
-#include <SDL.h>
+#include "CounterRng.h"
+#include "Snapshot.h"
+#include "TuningCache.h"
 #include <algorithm>
-#include <execution>
-#include <random>
+#include <chrono>
+#include <limits>
 
-PressVelWorldThreaded::PressVelWorldThreaded(const glm::ivec2& size)
-	: m_WaterCells(size.x, std::vector<WaterCell>(size.y, { {0, 0}, 0 }))
-	, m_Boundaries(size.x, std::vector<bool>(size.y, false))
-	, m_Directions(size.x, std::vector<glm::ivec2>(size.y, { 0, 0 }))
-	, m_Size(size)
-	, m_ThreadCount(std::min((int)std::thread::hardware_concurrency(), size.x / 3))
+namespace
 {
-	m_ThreadMutexes = std::vector<std::mutex>(m_ThreadCount);
-	m_CVs = std::vector<std::condition_variable>(m_ThreadCount);
-	m_UpdateVelocities = std::vector<std::atomic<bool>>(m_ThreadCount);
-	m_UpdateFluids = std::vector<std::atomic<bool>>(m_ThreadCount);
-
-	m_CellMutexes.reserve(size.x);
-	for (size_t i = 0; i < size.x; i++)
-	{
-		m_CellMutexes.emplace_back(std::vector<std::mutex>(size.y));
-	}
-
-	for (size_t i = 0; i < m_ThreadCount; i++)
+	void AddTransfer(PressVelWorldThreaded::WaterCell& destination, const glm::vec2& velocity, float amount)
 	{
-		m_Threads.emplace_back(std::thread([&](int threadIdx)
-		{
-			const int xStart = threadIdx * (m_Size.x / m_ThreadCount);
-			const int xEnd = (threadIdx != m_ThreadCount - 1) ? (threadIdx + 1) * (m_Size.x / m_ThreadCount) : m_Size.x;
+		if (amount == 0)
+			return;
 
-			std::unique_lock lk(m_ThreadMutexes[threadIdx]);
+		// Weighted average of velocities
+		destination.Velocity = (destination.Velocity * destination.Pressure + velocity * amount)
+			/ (destination.Pressure + amount);
 
-			while (true)
-			{
-				m_CVs[threadIdx].wait(lk, [&]() { return m_UpdateVelocities[threadIdx].load() || m_StopThreads.load(); });
-
-				if (m_StopThreads.load())
-					break;
-
-				// CALCULATE VELOCITIES
-				for (int x = xStart; x < xEnd; ++x)
-				{
-					for (int y = 0; y < m_Size.y; ++y)
-					{
-						// Drag
-						m_WaterCells[x][y].Velocity = m_WaterCells[x][y].Velocity * (1 - m_Drag);
-
-						// Gravity
-						m_WaterCells[x][y].Velocity.y += m_Gravity;
-
-						// Wind
-						//m_WaterCells[x][y].Velocity.x += 0.1f;
-
-						// Pressure diff flow
-						if (m_Boundaries[x][y])
-							continue;
-
-						const float pressureAtPos = m_WaterCells[x][y].Pressure;
-
-						if (IsPositionInBounds({ x, y + 1 }) && !m_Boundaries[x][y + 1])
-							m_WaterCells[x][y].Velocity += glm::vec2{ 0, 1 } *(pressureAtPos - m_WaterCells[x][y + 1].Pressure) * m_FlowDueToPressure;
-
-						if (IsPositionInBounds({ x, y - 1 }) && !m_Boundaries[x][y - 1])
-							m_WaterCells[x][y].Velocity += glm::vec2{ 0, -1 } *(pressureAtPos - m_WaterCells[x][y - 1].Pressure) * m_FlowDueToPressure;
-
-						if (IsPositionInBounds({ x + 1, y }) && !m_Boundaries[x + 1][y])
-							m_WaterCells[x][y].Velocity += glm::vec2{ 1, 0 } *(pressureAtPos - m_WaterCells[x + 1][y].Pressure) * m_FlowDueToPressure;
-
-						if (IsPositionInBounds({ x - 1, y }) && !m_Boundaries[x - 1][y])
-							m_WaterCells[x][y].Velocity += glm::vec2{ -1, 0 } *(pressureAtPos - m_WaterCells[x - 1][y].Pressure) * m_FlowDueToPressure;
-
-
-						// Calculate wanted directions
-						if (m_WaterCells[x][y].Pressure == 0 || m_WaterCells[x][y].Velocity == glm::vec2{ 0, 0 })
-							continue;
-
-						float xSize = abs(m_WaterCells[x][y].Velocity.x);
-						const float ySize = abs(m_WaterCells[x][y].Velocity.y);
-						const float total = xSize + ySize;
-						xSize /= total;
-
-						if (RandFloat() <= xSize)
-							m_Directions[x][y].x = (RandFloat() < xSize * m_VelocityMultiplier) * glm::sign(m_WaterCells[x][y].Velocity.x);
-						else
-							m_Directions[x][y].y = (RandFloat() < ySize * m_VelocityMultiplier) * glm::sign(m_WaterCells[x][y].Velocity.y);
-					}
-				}
-
-				m_UpdateVelocities[threadIdx].store(false);
-				m_CVs[threadIdx].notify_all();
-
-				// MOVE FLUID
-				m_CVs[threadIdx].wait(lk, [&]() { return m_UpdateFluids[threadIdx].load(); });
-
-				for (int x = xStart; x < xEnd; ++x)
-				{
-					for (int y = 0; y < m_Size.y; ++y)
-					{
-						if (m_WaterCells[x][y].Pressure < m_MinPressure)
-							continue;
-
-						const auto dir = m_Directions[x][y];
-						if (dir == glm::ivec2{ 0, 0 })
-							continue;
-
-						// Custom push-only flow
-						float remainingPressure = m_WaterCells[x][y].Pressure;
-
-						// Wanted direction
-						if (IsPositionInBounds(glm::ivec2{ x, y } + dir) &&
-							!m_Boundaries[x][y] && !m_Boundaries[x + dir.x][y + dir.y])
-						{
-							float flow;
-
-							if (IsPositionInBounds(glm::ivec2{ x, y } + dir + glm::ivec2{ 0, 1 }) && !m_Boundaries[x + dir.x][y + dir.y + 1])
-							{
-								flow = GetStableState(m_WaterCells[x + dir.x][y + dir.y].Pressure + m_WaterCells[x + dir.x][y + dir.y + 1].Pressure)
-									- m_WaterCells[x + dir.x][y + dir.y].Pressure;
-							}
-							else
-							{
-								flow = 1 - m_WaterCells[x + dir.x][y + dir.y].Pressure;
-							}
-							flow = glm::clamp(flow, 0.f, std::min(m_MaxFlow, remainingPressure));
-
-							TransferPressure(flow, { x, y }, { x + dir.x, y + dir.y });
-							remainingPressure -= flow;
-
-							if (remainingPressure <= 0)
-								continue;
-						}
-
-						// Give velocity to wanteddir cell in proportion to remaining
-						if (IsPositionInBounds(glm::ivec2{ x, y } + dir) &&
-							!m_Boundaries[x][y] && !m_Boundaries[x + dir.x][y + dir.y])
-						{
-							m_WaterCells[x + dir.x][y + dir.y].Velocity += m_WaterCells[x][y].Velocity * remainingPressure
-								/ m_WaterCells[x + dir.x][y + dir.y].Pressure;
-						}
-
-						// Left
-						if (IsPositionInBounds(glm::ivec2{ x + dir.y, y - dir.x }) &&
-							!m_Boundaries[x][y] && !m_Boundaries[x + dir.y][y - dir.x]) {
-							//Equalize the amount of water in this block and it's neighbour
-							float flow = (m_WaterCells[x][y].Pressure - m_WaterCells[x + dir.y][y - dir.x].Pressure) / 4;
-							flow = glm::clamp(flow, 0.f, remainingPressure);
-
-							glm::vec2 vel = glm::vec2{ dir.y, -dir.x } *0.5f * m_WaterCells[x][y].Velocity;
-							TransferPressure(flow, vel, { x, y }, { x + dir.y, y - dir.x });
-							remainingPressure -= flow;
-
-							if (remainingPressure <= 0)
-								continue;
-						}
-
-						// Right
-						if (IsPositionInBounds(glm::ivec2{ x - dir.y, y + dir.x }) &&
-							!m_Boundaries[x][y] && !m_Boundaries[x - dir.y][y + dir.x]) {
-							//Equalize the amount of water in this block and it's neighbour
-							float flow = (m_WaterCells[x][y].Pressure - m_WaterCells[x - dir.y][y + dir.x].Pressure) / 4;
-							flow = glm::clamp(flow, 0.f, remainingPressure);
-
-							glm::vec2 vel = glm::vec2{ -dir.y, dir.x } *0.5f * m_WaterCells[x][y].Velocity;
-							TransferPressure(flow, vel, { x, y }, { x - dir.y, y + dir.x });
-							remainingPressure -= flow;
-
-							if (remainingPressure <= 0)
-								continue;
-						}
-
-						// Up
-						if (IsPositionInBounds(glm::ivec2{ x, y + 1 }) &&
-							!m_Boundaries[x][y] && !m_Boundaries[x][y + 1]) {
-							float flow = remainingPressure - GetStableState(remainingPressure + m_WaterCells[x][y + 1].Pressure);
-							flow = glm::clamp(flow, 0.f, std::min(m_MaxFlow, remainingPressure));
-
-							const auto vel = glm::vec2{ m_WaterCells[x][y].Velocity.x, 0.5f };
-							TransferPressure(flow, vel, { x, y }, { x, y + 1 });
-							remainingPressure -= flow;
-						}
-					}
-				}
-
-				m_UpdateFluids[threadIdx].store(false);
-				m_CVs[threadIdx].notify_all();
-			}
-		}, i));
+		destination.Pressure += amount;
 	}
 }
 
-PressVelWorldThreaded::~PressVelWorldThreaded()
+PressVelWorldThreaded::PressVelWorldThreaded(const glm::ivec2& size, int tileSize, int threadCount, std::shared_ptr<WorkStealingScheduler> pScheduler)
+	: m_WaterCells(size, { {0, 0}, 0 })
+	, m_NextWaterCells(size, { {0, 0}, 0 })
+	, m_Boundaries(size, false)
+	, m_OpenNeighbours(size, 0)
+	, m_Directions(size, { 0, 0 })
+	, m_Flows(size, {})
+	, m_CarriedVelocities(size, { 0, 0 })
+	, m_Size(size)
+	, m_pScheduler(pScheduler ? std::move(pScheduler) : WorkStealingScheduler::GetShared())
+	, m_ThreadCount(threadCount > 0 ? threadCount : std::min((int)std::thread::hardware_concurrency(), size.x / 3))
 {
-	m_StopThreads.store(true);
-	for (int i = 0; i < m_ThreadCount; i++)
-	{
-		m_CVs[i].notify_all();
-		m_Threads[i].join();
-	}
+	m_ThreadCount = std::clamp(m_ThreadCount, 1, m_pScheduler->GetThreadCount());
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, size);
+	SetTileSize(tileSize);
 }
 
 glm::ivec2 PressVelWorldThreaded::GetSize() const
@@ -213,26 +52,20 @@ void PressVelWorldThreaded::SetWater(const glm::ivec2& position, bool water)
 	if (water)
 	{
 		// Remove boundaries
-		m_Boundaries[position.x][position.y] = false;
-		m_WaterCells[position.x][position.y].Pressure = 1;
+		m_Boundaries(position.x, position.y) = false;
+		m_WaterCells(position.x, position.y).Pressure = 1;
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, position, position + 1);
+		GetTileAt(position).HasWater = true;
 	}
 	else
 	{
-		m_WaterCells[position.x][position.y].Pressure = 0;
-		m_WaterCells[position.x][position.y].Velocity = { 0, 0 };
+		m_WaterCells(position.x, position.y).Pressure = 0;
+		m_WaterCells(position.x, position.y).Velocity = { 0, 0 };
 	}
 }
-std::vector<std::vector<float>> PressVelWorldThreaded::GetWaterPressures() const
+PressureView PressVelWorldThreaded::GetPressureView() const
 {
-	std::vector<std::vector<float>> pressures(m_Size.x, std::vector<float>(m_Size.y, 0));
-	for (int x = 0; x < m_Size.x; ++x)
-	{
-		for (int y = 0; y < m_Size.y; ++y)
-		{
-			pressures[x][y] = m_WaterCells[x][y].Pressure;
-		}
-	}
-	return pressures;
+	return PressureView(m_WaterCells, &WaterCell::Pressure);
 }
 
 void PressVelWorldThreaded::SetBoundary(const glm::ivec2& position, bool boundary)
@@ -242,39 +75,376 @@ void PressVelWorldThreaded::SetBoundary(const glm::ivec2& position, bool boundar
 		return;
 
 	// Set State
-	m_Boundaries[position.x][position.y] = boundary;
+	m_Boundaries(position.x, position.y) = boundary;
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, position, position + 1);
 }
-std::vector<std::vector<bool>> PressVelWorldThreaded::GetBoundaries() const
+BoundaryView PressVelWorldThreaded::GetBoundaryView() const
 {
-	return m_Boundaries;
+	return BoundaryView(m_Boundaries);
 }
 
-void PressVelWorldThreaded::TransferPressure(float amount, const glm::ivec2& start, const glm::ivec2& destination)
+void PressVelWorldThreaded::SetWaterRegion(const Region& region, bool water)
 {
-	const glm::vec2 velocity = m_WaterCells[start.x][start.y].Velocity;
-	TransferPressure(amount, velocity, start, destination);
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int count = column.YEnd - column.YStart;
+		WaterCell* pCells = m_WaterCells.GetLine(x) + column.YStart;
+
+		if (water)
+		{
+			std::fill_n(m_Boundaries.GetLine(x) + column.YStart, count, false);
+			for (int i = 0; i < count; ++i)
+			{
+				pCells[i].Pressure = 1;
+			}
+		}
+		else
+		{
+			std::fill_n(pCells, count, WaterCell{ { 0, 0 }, 0 });
+		}
+	}
+
+	if (water && !region.IsEmpty())
+	{
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, region.GetMin(), region.GetMax());
+		MarkTilesWet(region.GetMin(), region.GetMax());
+	}
 }
-void PressVelWorldThreaded::TransferPressure(float amount, const glm::vec2& velocity, const glm::ivec2& start, const glm::ivec2& destination)
+
+void PressVelWorldThreaded::SetBoundaryRegion(const Region& region, bool boundary)
 {
-	if (start == destination || amount == 0 ||
-		m_Boundaries[start.x][start.y] || m_Boundaries[destination.x][destination.y])
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
 	{
+		const Region::Column column = region.GetColumn(x);
+		std::fill_n(m_Boundaries.GetLine(x) + column.YStart, column.YEnd - column.YStart, boundary);
+	}
+
+	if (!region.IsEmpty())
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, region.GetMin(), region.GetMax());
+}
+
+void PressVelWorldThreaded::LoadPressures(const PressureView& pressures)
+{
+	const glm::ivec2 size = glm::min(pressures.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		WaterCell* pCells = m_WaterCells.GetLine(x);
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pCells[y] = { { 0, 0 }, pressures(x, y) };
+			if (pCells[y].Pressure > 0)
+				pBoundaries[y] = false;
+		}
+	}
+
+	if (size.x > 0 && size.y > 0)
+	{
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, size);
+		MarkTilesWet({ 0, 0 }, size);
+	}
+}
+
+void PressVelWorldThreaded::LoadBoundaries(const BitmaskView& boundaries)
+{
+	const glm::ivec2 size = glm::min(boundaries.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pBoundaries[y] = boundaries(x, y);
+		}
+	}
+
+	if (size.x > 0 && size.y > 0)
+		UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, size);
+}
+
+void PressVelWorldThreaded::WriteSnapshot(SnapshotWriter& writer) const
+{
+	writer.SetWorldType("PressVelWorldThreaded");
+	writer.AddValue(m_Step);
+	writer.AddPlane(m_WaterCells);
+	writer.AddPlane(m_Boundaries);
+}
+
+bool PressVelWorldThreaded::ReadSnapshot(SnapshotReader& reader)
+{
+	if (!reader.IsWorldType("PressVelWorldThreaded"))
+		return false;
+
+	uint64_t step;
+	if (!reader.ReadValue(step) || !reader.ReadPlanes(m_WaterCells, m_Boundaries))
+		return false;
+
+	m_Step = static_cast<uint32_t>(step);
+	UpdateOpenNeighbours(m_OpenNeighbours, m_Boundaries, { 0, 0 }, m_Size);
+
+	// Dry tiles are not copied forward, their next buffer has to match already
+	m_NextWaterCells = m_WaterCells;
+	if (m_Size.x > 0 && m_Size.y > 0)
+		MarkTilesWet({ 0, 0 }, m_Size);
+	return true;
+}
+
+void PressVelWorldThreaded::UpdateVelocities(const Tile& tile)
+{
+	for (int x = tile.Min.x; x < tile.Max.x; ++x)
+	{
+		for (int y = tile.Min.y; y < tile.Max.y; ++y)
+		{
+			m_Directions(x, y) = { 0, 0 };
+
+			// Drag
+			m_WaterCells(x, y).Velocity = m_WaterCells(x, y).Velocity * (1 - m_Drag);
+
+			// Gravity
+			m_WaterCells(x, y).Velocity.y += m_Gravity;
+
+			// Wind
+			//m_WaterCells(x, y).Velocity.x += 0.1f;
+
+			// Pressure diff flow
+			if (m_Boundaries(x, y))
+				continue;
+
+			const float pressureAtPos = m_WaterCells(x, y).Pressure;
+			const uint8_t open = m_OpenNeighbours(x, y);
+
+			if (open & OpenUp)
+				m_WaterCells(x, y).Velocity += glm::vec2{ 0, 1 } *(pressureAtPos - m_WaterCells(x, y + 1).Pressure) * m_FlowDueToPressure;
+
+			if (open & OpenDown)
+				m_WaterCells(x, y).Velocity += glm::vec2{ 0, -1 } *(pressureAtPos - m_WaterCells(x, y - 1).Pressure) * m_FlowDueToPressure;
+
+			if (open & OpenRight)
+				m_WaterCells(x, y).Velocity += glm::vec2{ 1, 0 } *(pressureAtPos - m_WaterCells(x + 1, y).Pressure) * m_FlowDueToPressure;
+
+			if (open & OpenLeft)
+				m_WaterCells(x, y).Velocity += glm::vec2{ -1, 0 } *(pressureAtPos - m_WaterCells(x - 1, y).Pressure) * m_FlowDueToPressure;
+
+
+			// Calculate wanted directions
+			if (m_WaterCells(x, y).Pressure == 0 || m_WaterCells(x, y).Velocity == glm::vec2{ 0, 0 })
+				continue;
+
+			float xSize = abs(m_WaterCells(x, y).Velocity.x);
+			const float ySize = abs(m_WaterCells(x, y).Velocity.y);
+			const float total = xSize + ySize;
+			xSize /= total;
+
+			if (RandomFloat(m_Seed, m_Step, { x, y }, 0) <= xSize)
+				m_Directions(x, y).x = (RandomFloat(m_Seed, m_Step, { x, y }, 1) < xSize * m_VelocityMultiplier) * glm::sign(m_WaterCells(x, y).Velocity.x);
+			else
+				m_Directions(x, y).y = (RandomFloat(m_Seed, m_Step, { x, y }, 1) < ySize * m_VelocityMultiplier) * glm::sign(m_WaterCells(x, y).Velocity.y);
+		}
+	}
+}
+
+void PressVelWorldThreaded::TransferPressure(float amount, const glm::vec2& velocity, const glm::ivec2& start, const glm::ivec2& destination, const Tile& tile)
+{
+	// Only called for open neighbours, neither cell is a boundary
+	if (amount == 0)
 		return;
+
+	if (IsInsideTile(start, tile))
+		m_NextWaterCells(start.x, start.y).Pressure -= amount;
+
+	if (IsInsideTile(destination, tile))
+		AddTransfer(m_NextWaterCells(destination.x, destination.y), velocity, amount);
+}
+
+void PressVelWorldThreaded::MoveFluid(const Tile& tile)
+{
+	// The next buffer starts as a copy of the current one. Inside the tile the cells are visited
+	// in the same order as a single pass over the whole world would, so they can be moved right
+	// away. The edges also get water from the tiles next to them and are done once they are all done.
+	CopyTileForward(tile);
+
+	for (int x = tile.Min.x; x < tile.Max.x; ++x)
+	{
+		for (int y = tile.Min.y; y < tile.Max.y; ++y)
+		{
+			Flows& flows = m_Flows(x, y);
+			flows = {};
+
+			if (m_WaterCells(x, y).Pressure < m_MinPressure)
+				continue;
+
+			const auto dir = m_Directions(x, y);
+			if (dir == glm::ivec2{ 0, 0 })
+				continue;
+
+			const glm::vec2 velocity = GetCarriedVelocity(x, y);
+			m_CarriedVelocities(x, y) = velocity;
+
+			// Custom push-only flow
+			float remainingPressure = m_WaterCells(x, y).Pressure;
+			const uint8_t open = m_OpenNeighbours(x, y);
+
+			// Wanted direction
+			if (open & GetOpenNeighbourBit(dir))
+			{
+				const float flow = glm::clamp(GetWantedFlow(x + dir.x, y + dir.y), 0.f, std::min(m_MaxFlow, remainingPressure));
+
+				flows.ToSides[GetSideIndex(dir)] = flow;
+				TransferPressure(flow, velocity, { x, y }, { x + dir.x, y + dir.y }, tile);
+				remainingPressure -= flow;
+
+				// What remains gives its velocity to the wanted cell, see GetCarriedVelocity()
+				if (remainingPressure <= 0)
+					continue;
+			}
+
+			// Left
+			if (open & GetOpenNeighbourBit({ dir.y, -dir.x })) {
+				//Equalize the amount of water in this block and it's neighbour
+				float flow = (m_WaterCells(x, y).Pressure - m_WaterCells(x + dir.y, y - dir.x).Pressure) / 4;
+				flow = glm::clamp(flow, 0.f, remainingPressure);
+
+				flows.ToSides[GetSideIndex({ dir.y, -dir.x })] = flow;
+				glm::vec2 vel = glm::vec2{ dir.y, -dir.x } *0.5f * velocity;
+				TransferPressure(flow, vel, { x, y }, { x + dir.y, y - dir.x }, tile);
+				remainingPressure -= flow;
+
+				if (remainingPressure <= 0)
+					continue;
+			}
+
+			// Right
+			if (open & GetOpenNeighbourBit({ -dir.y, dir.x })) {
+				//Equalize the amount of water in this block and it's neighbour
+				float flow = (m_WaterCells(x, y).Pressure - m_WaterCells(x - dir.y, y + dir.x).Pressure) / 4;
+				flow = glm::clamp(flow, 0.f, remainingPressure);
+
+				flows.ToSides[GetSideIndex({ -dir.y, dir.x })] = flow;
+				glm::vec2 vel = glm::vec2{ -dir.y, dir.x } *0.5f * velocity;
+				TransferPressure(flow, vel, { x, y }, { x - dir.y, y + dir.x }, tile);
+				remainingPressure -= flow;
+
+				if (remainingPressure <= 0)
+					continue;
+			}
+
+			// Up
+			if (open & OpenUp) {
+				float flow = remainingPressure - GetStableState(remainingPressure + m_WaterCells(x, y + 1).Pressure);
+				flow = glm::clamp(flow, 0.f, std::min(m_MaxFlow, remainingPressure));
+
+				flows.Up = flow;
+				const auto vel = glm::vec2{ velocity.x, 0.5f };
+				TransferPressure(flow, vel, { x, y }, { x, y + 1 }, tile);
+			}
+		}
 	}
+}
 
-	// Weighted average of velocities
-	std::unique_lock lk1(m_CellMutexes[destination.x][destination.y]);
-		m_NextWaterCells[destination.x][destination.y].Velocity =
-			(m_NextWaterCells[destination.x][destination.y].Velocity * m_NextWaterCells[destination.x][destination.y].Pressure
-				+ velocity * amount)
-			/ (m_NextWaterCells[destination.x][destination.y].Pressure + amount);
+float PressVelWorldThreaded::GetWantedFlow(int x, int y) const
+{
+	if (m_OpenNeighbours(x, y) & OpenUp)
+		return GetStableState(m_WaterCells(x, y).Pressure + m_WaterCells(x, y + 1).Pressure) - m_WaterCells(x, y).Pressure;
 
-		m_NextWaterCells[destination.x][destination.y].Pressure += amount;
-	lk1.unlock();
+	return 1 - m_WaterCells(x, y).Pressure;
+}
 
-	std::unique_lock lk2(m_CellMutexes[start.x][start.y]);
-		m_NextWaterCells[start.x][start.y].Pressure -= amount;
-	lk2.unlock();
+glm::vec2 PressVelWorldThreaded::GetCarriedVelocity(int x, int y) const
+{
+	// Give velocity to wanteddir cell in proportion to remaining. The neighbours hand over what
+	// they had before the step, so it does not matter which of them were visited first.
+	const WaterCell& cell = m_WaterCells(x, y);
+	glm::vec2 velocity = cell.Velocity;
+
+	for (const glm::ivec2& offset : { glm::ivec2{ 1, 0 }, glm::ivec2{ 0, 1 }, glm::ivec2{ 0, -1 }, glm::ivec2{ -1, 0 } })
+	{
+		const glm::ivec2 source = glm::ivec2{ x, y } - offset;
+		if (!IsPositionInBounds(source) || m_Directions(source.x, source.y) != offset)
+			continue;
+
+		// The same flow MoveFluid() works out for the neighbour
+		const WaterCell& sourceCell = m_WaterCells(source.x, source.y);
+		if (sourceCell.Pressure < m_MinPressure || !(m_OpenNeighbours(source.x, source.y) & GetOpenNeighbourBit(offset)))
+			continue;
+
+		const float flow = glm::clamp(GetWantedFlow(x, y), 0.f, std::min(m_MaxFlow, sourceCell.Pressure));
+		const float remainingPressure = sourceCell.Pressure - flow;
+		if (remainingPressure > 0)
+			velocity += sourceCell.Velocity * remainingPressure / cell.Pressure;
+	}
+
+	return velocity;
+}
+
+void PressVelWorldThreaded::GatherTileEdges(const Tile& tile)
+{
+	for (int x = tile.Min.x; x < tile.Max.x; ++x)
+	{
+		if (x == tile.Min.x || x == tile.Max.x - 1)
+		{
+			for (int y = tile.Min.y; y < tile.Max.y; ++y)
+			{
+				GatherCell(x, y);
+			}
+		}
+		else
+		{
+			GatherCell(x, tile.Min.y);
+			if (tile.Max.y - 1 > tile.Min.y)
+				GatherCell(x, tile.Max.y - 1);
+		}
+	}
+}
+
+void PressVelWorldThreaded::GatherCell(int x, int y)
+{
+	// Takes what the neighbours give in the order a single pass over the whole world would
+	WaterCell cell = m_WaterCells(x, y);
+
+	GatherFrom({ x - 1, y }, { 1, 0 }, cell);
+	GatherFrom({ x, y - 1 }, { 0, 1 }, cell);
+
+	// Given away in the order MoveFluid() works them out in, a side that is not given to holds 0
+	const Flows& flows = m_Flows(x, y);
+	const glm::ivec2 dir = m_Directions(x, y);
+	cell.Pressure -= flows.ToSides[GetSideIndex(dir)];
+	cell.Pressure -= flows.ToSides[GetSideIndex({ dir.y, -dir.x })];
+	cell.Pressure -= flows.ToSides[GetSideIndex({ -dir.y, dir.x })];
+	cell.Pressure -= flows.Up;
+
+	GatherFrom({ x, y + 1 }, { 0, -1 }, cell);
+	GatherFrom({ x + 1, y }, { -1, 0 }, cell);
+
+	m_NextWaterCells(x, y) = cell;
+}
+
+void PressVelWorldThreaded::GatherFrom(const glm::ivec2& source, const glm::ivec2& offset, WaterCell& cell) const
+{
+	if (!IsPositionInBounds(source))
+		return;
+
+	const Flows& flows = m_Flows(source.x, source.y);
+	const float amount = flows.ToSides[GetSideIndex(offset)];
+	if (amount != 0)
+	{
+		// Both sides of the wanted direction get half the velocity pointing their way
+		const glm::vec2 velocity = m_CarriedVelocities(source.x, source.y);
+		if (m_Directions(source.x, source.y) == offset)
+			AddTransfer(cell, velocity, amount);
+		else
+			AddTransfer(cell, glm::vec2(offset) * 0.5f * velocity, amount);
+	}
+
+	if (offset.y == 1 && flows.Up != 0)
+		AddTransfer(cell, glm::vec2{ m_CarriedVelocities(source.x, source.y).x, 0.5f }, flows.Up);
+}
+
+int PressVelWorldThreaded::GetSideIndex(const glm::ivec2& offset)
+{
+	// Left, below, above, right. No offset at all ends up above, it never has a flow.
+	if (offset.x != 0)
+		return offset.x < 0 ? 0 : 3;
+	return offset.y < 0 ? 1 : 2;
 }
 
 float PressVelWorldThreaded::GetStableState(float totalPressure) const
@@ -298,58 +468,245 @@ bool PressVelWorldThreaded::IsPositionInBounds(const glm::ivec2& position) const
 		position.y >= 0 && position.y < m_Size.y;
 }
 
-float PressVelWorldThreaded::RandFloat()
+bool PressVelWorldThreaded::IsInsideTile(const glm::ivec2& position, const Tile& tile)
+{
+	return position.x > tile.Min.x && position.x < tile.Max.x - 1 &&
+		position.y > tile.Min.y && position.y < tile.Max.y - 1;
+}
+
+PressVelWorldThreaded::Tile& PressVelWorldThreaded::GetTileAt(const glm::ivec2& position)
 {
-	static thread_local std::mt19937 generator;
-	const std::uniform_real_distribution<float> distribution(0.f, 1.f);
-	return distribution(generator);
+	return m_Tiles[(position.x / m_TileSize) * m_TileCount.y + position.y / m_TileSize];
+}
+
+void PressVelWorldThreaded::MarkTilesWet(const glm::ivec2& min, const glm::ivec2& max)
+{
+	// Tiles that turn out to be dry are skipped again after the next Validate()
+	const glm::ivec2 minTile = min / m_TileSize;
+	const glm::ivec2 maxTile = (max - 1) / m_TileSize;
+	for (int tileX = minTile.x; tileX <= maxTile.x; ++tileX)
+	{
+		for (int tileY = minTile.y; tileY <= maxTile.y; ++tileY)
+		{
+			m_Tiles[tileX * m_TileCount.y + tileY].HasWater = true;
+		}
+	}
 }
 
 void PressVelWorldThreaded::Update()
 {
-	// Update velocities
-	for (int i = 0; i < m_ThreadCount; i++)
+	m_StepStats.Reset();
+	ScopedPhaseTimer timer(m_StepStats, "Velocities");
+	++m_Step;
+
+	// Only tiles with water have anything to do, the ones next to them can get some
+	m_ActiveTiles.clear();
+	m_ReceivingTiles.clear();
+	for (int tileX = 0; tileX < m_TileCount.x; ++tileX)
 	{
-		m_UpdateVelocities[i].store(true);
-		m_CVs[i].notify_all();
+		for (int tileY = 0; tileY < m_TileCount.y; ++tileY)
+		{
+			const int i = tileX * m_TileCount.y + tileY;
+			if (m_Tiles[i].HasWater)
+				m_ActiveTiles.push_back(i);
+
+			if (m_Tiles[i].HasWater
+				|| (tileX > 0 && m_Tiles[i - m_TileCount.y].HasWater)
+				|| (tileX < m_TileCount.x - 1 && m_Tiles[i + m_TileCount.y].HasWater)
+				|| (tileY > 0 && m_Tiles[i - 1].HasWater)
+				|| (tileY < m_TileCount.y - 1 && m_Tiles[i + 1].HasWater))
+				m_ReceivingTiles.push_back(i);
+		}
 	}
 
-	for (size_t i = 0; i < m_ThreadCount; i++)
+	for (const int tileIdx : m_ActiveTiles)
 	{
-		std::unique_lock lk(m_ThreadMutexes[i]);
-		m_CVs[i].wait(lk, [&]() { return !m_UpdateVelocities[i].load(); });
+		const Tile& tile = m_Tiles[tileIdx];
+		m_StepStats.AddCells(static_cast<long long>(tile.Max.x - tile.Min.x) * (tile.Max.y - tile.Min.y));
 	}
 
+	// Update velocities
+	m_pScheduler->Run(static_cast<int>(m_ActiveTiles.size()), [&](int task)
+	{
+		UpdateVelocities(m_Tiles[m_ActiveTiles[task]]);
+	}, m_ThreadCount);
+
 	// Move cells
-	m_NextWaterCells = m_WaterCells;
+	timer.Next("Move");
+	m_pScheduler->Run(static_cast<int>(m_ActiveTiles.size()), [&](int task)
+	{
+		MoveFluid(m_Tiles[m_ActiveTiles[task]]);
+	}, m_ThreadCount);
 
-	for (int i = 0; i < m_ThreadCount; i++)
+	// The edges take their own transfers, the ones across tile edges included
+	timer.Next("Transfers");
+	m_pScheduler->Run(static_cast<int>(m_ReceivingTiles.size()), [&](int task)
 	{
-		m_UpdateFluids[i].store(true);
-		m_CVs[i].notify_all();
-	}
+		GatherTileEdges(m_Tiles[m_ReceivingTiles[task]]);
+	}, m_ThreadCount);
 
-	for (size_t i = 0; i < m_ThreadCount; i++)
+	m_WaterCells.Swap(m_NextWaterCells);
+
+	// Make everything valid, the other tiles did not change
+	timer.Next("Validate");
+	m_pScheduler->Run(static_cast<int>(m_ReceivingTiles.size()), [&](int task)
 	{
-		std::unique_lock lk(m_ThreadMutexes[i]);
-		m_CVs[i].wait(lk, [&]() { return !m_UpdateFluids[i].load(); });
-	}
+		Validate(m_Tiles[m_ReceivingTiles[task]]);
+	}, m_ThreadCount);
+
+	timer.Next(nullptr);
+	m_pScheduler->TakeThreadTimes(m_StepStats);
+}
 
-	m_WaterCells = m_NextWaterCells;
+void PressVelWorldThreaded::Validate(Tile& tile)
+{
+	tile.HasWater = false;
 
-	// Make everything valid
-	for (int y = 0; y < m_Size.y; ++y)
+	for (int x = tile.Min.x; x < tile.Max.x; ++x)
 	{
-		for (int x = 0; x < m_Size.x; ++x)
+		for (int y = tile.Min.y; y < tile.Max.y; ++y)
 		{
-			if (m_Boundaries[x][y])
+			if (m_Boundaries(x, y))
 			{
-				m_WaterCells[x][y].Velocity = { 0, 0 };
-				m_WaterCells[x][y].Pressure = 0;
+				m_WaterCells(x, y).Velocity = { 0, 0 };
+				m_WaterCells(x, y).Pressure = 0;
 			}
 
-			if (m_WaterCells[x][y].Pressure < m_MinPressure)
-				m_WaterCells[x][y].Velocity = { 0, 0 };
+			if (m_WaterCells(x, y).Pressure < m_MinPressure)
+				m_WaterCells(x, y).Velocity = { 0, 0 };
+
+			if (m_WaterCells(x, y).Pressure > 0)
+				tile.HasWater = true;
+		}
+	}
+
+	// Dry tiles are skipped, so their other buffer has to be dry as well and they give nothing
+	// to the tiles next to them
+	if (!tile.HasWater)
+	{
+		CopyTileForward(tile);
+		for (int x = tile.Min.x; x < tile.Max.x; ++x)
+		{
+			std::fill(&m_Flows(x, tile.Min.y), &m_Flows(x, tile.Max.y - 1) + 1, Flows{});
+		}
+	}
+}
+
+void PressVelWorldThreaded::CopyTileForward(const Tile& tile)
+{
+	for (int x = tile.Min.x; x < tile.Max.x; ++x)
+	{
+		std::copy(&m_WaterCells(x, tile.Min.y), &m_WaterCells(x, tile.Max.y - 1) + 1, &m_NextWaterCells(x, tile.Min.y));
+	}
+}
+
+void PressVelWorldThreaded::SetTileSize(int tileSize)
+{
+	m_TileSize = std::max(tileSize, 1);
+	m_TileCount = (m_Size + m_TileSize - 1) / m_TileSize;
+
+	m_Tiles.clear();
+	m_Tiles.resize(static_cast<size_t>(m_TileCount.x) * m_TileCount.y);
+	for (int tileX = 0; tileX < m_TileCount.x; ++tileX)
+	{
+		for (int tileY = 0; tileY < m_TileCount.y; ++tileY)
+		{
+			Tile& tile = m_Tiles[tileX * m_TileCount.y + tileY];
+			tile.Min = glm::ivec2{ tileX, tileY } * m_TileSize;
+			tile.Max = glm::min(tile.Min + m_TileSize, m_Size);
+			Validate(tile);
+		}
+	}
+}
+
+int PressVelWorldThreaded::GetTileSize() const
+{
+	return m_TileSize;
+}
+
+void PressVelWorldThreaded::SetThreadCount(int threadCount)
+{
+	m_ThreadCount = std::clamp(threadCount, 1, m_pScheduler->GetThreadCount());
+}
+
+int PressVelWorldThreaded::GetThreadCount() const
+{
+	return m_ThreadCount;
+}
+
+bool PressVelWorldThreaded::AutoTune(const std::string& cachePath)
+{
+	const char* pWorldType = "PressVelWorldThreaded";
+	const int availableThreads = m_pScheduler->GetThreadCount();
+
+	TuningCache cache;
+	const bool cacheLoaded = cachePath.empty() || cache.Load(cachePath);
+	TuningCache::Config best;
+	if (cache.Find(pWorldType, m_Size, availableThreads, best))
+	{
+		SetThreadCount(best.ThreadCount);
+		SetTileSize(best.TileSize);
+		return cacheLoaded;
+	}
+
+	// Every try starts from the state the world is in now
+	const Grid2D<WaterCell> waterCells = m_WaterCells;
+	const Grid2D<WaterCell> nextWaterCells = m_NextWaterCells;
+	const uint32_t step = m_Step;
+
+	std::vector<int> threadCounts;
+	for (int threadCount = 1; threadCount < availableThreads; threadCount *= 2)
+	{
+		threadCounts.push_back(threadCount);
+	}
+	threadCounts.push_back(availableThreads);
+
+	best = { m_ThreadCount, m_TileSize, std::numeric_limits<long long>::max() };
+	for (int tileSize = 8; tileSize <= 64; tileSize *= 2)
+	{
+		for (const int threadCount : threadCounts)
+		{
+			m_WaterCells = waterCells;
+			m_NextWaterCells = nextWaterCells;
+			m_Step = step;
+			SetThreadCount(threadCount);
+			SetTileSize(tileSize);
+
+			const long long stepNanoseconds = TimeSteps();
+			if (stepNanoseconds < best.StepNanoseconds)
+				best = { threadCount, tileSize, stepNanoseconds };
 		}
+
+		// Any bigger tile covers the whole world as well
+		if (tileSize >= std::max(m_Size.x, m_Size.y))
+			break;
+	}
+
+	m_WaterCells = waterCells;
+	m_NextWaterCells = nextWaterCells;
+	m_Step = step;
+	SetThreadCount(best.ThreadCount);
+	SetTileSize(best.TileSize);
+
+	if (cachePath.empty())
+		return true;
+
+	cache.Store(pWorldType, m_Size, availableThreads, best);
+	return cache.Save(cachePath) && cacheLoaded;
+}
+
+long long PressVelWorldThreaded::TimeSteps()
+{
+	Update();
+
+	std::vector<long long> stepTimes(TuningSteps);
+	for (long long& stepTime : stepTimes)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		Update();
+		stepTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
 	}
+
+	std::sort(stepTimes.begin(), stepTimes.end());
+	return stepTimes[TuningSteps / 2];
 }
@@ -1,8 +1,12 @@
 #pragma once
 #include "World.h"
+#include "Grid2D.h"
+#include "OpenNeighbours.h"
 
-#include <thread>
-#include <condition_variable>
+#include "WorkStealingScheduler.h"
+
+#include <memory>
+#include <string>
 
 class PressVelWorldThreaded : public World
 {
@@ -13,44 +17,121 @@ public:
 		float Pressure;
 	};
 
-	PressVelWorldThreaded(const glm::ivec2& size);
-	~PressVelWorldThreaded();
+	// A thread count of 0 picks one based on the hardware and the world size. The tiles are run
+	// on that many threads of the scheduler, the shared one if none is given.
+	PressVelWorldThreaded(const glm::ivec2& size, int tileSize = 32, int threadCount = 0, std::shared_ptr<WorkStealingScheduler> pScheduler = nullptr);
 
 	[[nodiscard]] glm::ivec2 GetSize() const override;
 
 	void SetWater(const glm::ivec2& position, bool water) override;
-	[[nodiscard]] std::vector<std::vector<float>> GetWaterPressures() const override;
+	[[nodiscard]] PressureView GetPressureView() const override;
 
 	void SetBoundary(const glm::ivec2& position, bool boundary) override;
-	[[nodiscard]] std::vector<std::vector<bool>> GetBoundaries() const override;
+	[[nodiscard]] BoundaryView GetBoundaryView() const override;
+
+	void SetWaterRegion(const Region& region, bool water) override;
+	void SetBoundaryRegion(const Region& region, bool boundary) override;
+	void LoadPressures(const PressureView& pressures) override;
+	void LoadBoundaries(const BitmaskView& boundaries) override;
+
+	void WriteSnapshot(SnapshotWriter& writer) const override;
+	[[nodiscard]] bool ReadSnapshot(SnapshotReader& reader) override;
 
+	using World::Update;
 	void Update() override;
 
+	// The world is updated in square tiles of this size, tiles are spread over the threads. Like the
+	// thread count it only changes how fast a step is, not what it does.
+	void SetTileSize(int tileSize);
+	[[nodiscard]] int GetTileSize() const;
+
+	// At most the thread count of the scheduler
+	void SetThreadCount(int threadCount);
+	[[nodiscard]] int GetThreadCount() const;
+
+	// Times a few steps with a range of thread counts and tile sizes and keeps the fastest. The world
+	// is put back the way it was after every try and steps the same whatever is picked, call it
+	// once the water is in. With a cache file,
+	// a configuration found before for this size and scheduler is taken without timing anything and
+	// new ones are added to the file. Returns false if the file couldn't be read or written.
+	[[nodiscard]] bool AutoTune(const std::string& cachePath = "");
+
 private:
-	void TransferPressure(float amount, const glm::ivec2& start, const glm::ivec2& destination);
-	void TransferPressure(float amount, const glm::vec2& velocity, const glm::ivec2& start, const glm::ivec2& destination);
+	// What a cell gives to its neighbours in one step, worked out from the current buffer only
+	struct Flows
+	{
+		// To the cells left of, below, above and right of it, see GetSideIndex(). Each side gets
+		// either the wanted flow or one of the flows to the sides of the wanted direction.
+		float ToSides[4];
+		// To the cell above once the rest is given
+		float Up;
+	};
+
+	struct Tile
+	{
+		glm::ivec2 Min;
+		glm::ivec2 Max;
+		// Tiles without any water are skipped
+		bool HasWater = false;
+	};
+
+	void UpdateVelocities(const Tile& tile);
+	void MoveFluid(const Tile& tile);
+	void GatherTileEdges(const Tile& tile);
+	void Validate(Tile& tile);
+	void CopyTileForward(const Tile& tile);
+
+	// Moves pressure right away if both cells are inside the tile and off its edge, the cells on
+	// the edges of the tiles are worked out by GatherTileEdges() from the flows instead
+	void TransferPressure(float amount, const glm::vec2& velocity, const glm::ivec2& start, const glm::ivec2& destination, const Tile& tile);
+	static bool IsInsideTile(const glm::ivec2& position, const Tile& tile);
+
+	void GatherCell(int x, int y);
+	// Applies what the source next to the cell gives it, the offset goes from the source to the cell
+	void GatherFrom(const glm::ivec2& source, const glm::ivec2& offset, WaterCell& cell) const;
+	static int GetSideIndex(const glm::ivec2& offset);
+
+	// The most a neighbour pushes into the cell when it is the direction the neighbour wants
+	float GetWantedFlow(int x, int y) const;
+	// The cell's velocity plus what the neighbours that want to go into it hand to it
+	glm::vec2 GetCarriedVelocity(int x, int y) const;
 
 	float GetStableState(float totalPressure) const;
 
-	bool IsPositionInBounds(const glm::ivec2& position) const;
+	// Median time of TuningSteps steps, the world is left stepped
+	long long TimeSteps();
 
-	static float RandFloat();
+	bool IsPositionInBounds(const glm::ivec2& position) const;
+	Tile& GetTileAt(const glm::ivec2& position);
+	// Makes sure the tiles with any of the cells [min, max) are updated
+	void MarkTilesWet(const glm::ivec2& min, const glm::ivec2& max);
 
-	std::vector<std::vector<WaterCell>> m_WaterCells;
-	std::vector<std::vector<WaterCell>> m_NextWaterCells;
-	std::vector<std::vector<bool>> m_Boundaries;
-	std::vector<std::vector<glm::ivec2>> m_Directions;
+	Grid2D<WaterCell> m_WaterCells;
+	Grid2D<WaterCell> m_NextWaterCells;
+	Grid2D<bool> m_Boundaries;
+	// See OpenNeighbours.h, updated whenever the boundaries change
+	Grid2D<uint8_t> m_OpenNeighbours;
+	Grid2D<glm::ivec2> m_Directions;
+	Grid2D<Flows> m_Flows;
+	// The velocity a cell's transfers carry, its own plus what its neighbours handed to it
+	Grid2D<glm::vec2> m_CarriedVelocities;
 	glm::ivec2 m_Size;
+	uint32_t m_Step = 0;
+
+	// Tiles
+	int m_TileSize;
+	glm::ivec2 m_TileCount;
+	std::vector<Tile> m_Tiles;
+	std::vector<int> m_ActiveTiles;
+	// The tiles with water and the ones next to them, the only ones water can end up in
+	std::vector<int> m_ReceivingTiles;
 
 	// Threads
+	std::shared_ptr<WorkStealingScheduler> m_pScheduler;
 	int m_ThreadCount;
-	std::vector<std::thread> m_Threads;
-	std::vector<std::mutex> m_ThreadMutexes;
-	std::vector<std::vector<std::mutex>> m_CellMutexes;
-	std::vector<std::condition_variable> m_CVs;
-	std::vector<std::atomic<bool>> m_UpdateVelocities;
-	std::vector<std::atomic<bool>> m_UpdateFluids;
-	std::atomic<bool> m_StopThreads = false;
+
+	// Steps timed for every configuration AutoTune() tries, after one untimed step
+	static constexpr int TuningSteps = 8;
 
 	const float m_Gravity = -0.1f;
 	const float m_Drag = 0.1f;
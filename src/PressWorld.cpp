@@ -1,12 +1,29 @@
 #include "PressWorld.h"
+#include "Snapshot.h"
 
 #include <algorithm>
 
+namespace
+{
+	// The parameters in the order they are stored in snapshots
+	constexpr float PressFlowParams::* SnapshotParams[] = {
+		&PressFlowParams::MaxPressure,
+		&PressFlowParams::MinPressure,
+		&PressFlowParams::MaxCompression,
+		&PressFlowParams::MinFlow,
+		&PressFlowParams::MaxFlow
+	};
+}
+
 PressWorld::PressWorld(const glm::ivec2& size)
-	: m_WaterCells(size.x, std::vector<float>(size.y, 0))
-	, m_NextWaterCells(size.x, std::vector<float>(size.y, 0))
-	, m_Boundaries(size.x, std::vector<bool>(size.y, false))
+	: m_WaterCells(size, 0)
+	, m_NextWaterCells(size, 0)
+	, m_Boundaries(size, false)
 	, m_Size(size)
+	, m_WetSpans(size.x)
+	, m_NextWetSpans(size.x)
+	, m_ComputeFlows(SelectComputeFlows<PressFlowParams>())
+	, m_ComputeDefaultFlows(SelectComputeFlows<DefaultPressFlowParams>())
 {}
 
 glm::ivec2 PressWorld::GetSize() const
@@ -22,17 +39,18 @@ void PressWorld::SetWater(const glm::ivec2& position, bool water)
 	if (water)
 	{
 		// Remove boundaries
-		m_Boundaries[position.x][position.y] = false;
-		m_WaterCells[position.x][position.y] = 1;
+		m_Boundaries(position.x, position.y) = false;
+		m_WaterCells(position.x, position.y) = 1;
+		m_WetSpans[position.x] = m_WetSpans[position.x].Include({ position.y, position.y + 1 });
 	}
 	else
 	{
-		m_WaterCells[position.x][position.y] = 0;
+		m_WaterCells(position.x, position.y) = 0;
 	}
 }
-std::vector<std::vector<float>> PressWorld::GetWaterPressures() const
+PressureView PressWorld::GetPressureView() const
 {
-	return m_WaterCells;
+	return PressureView(m_WaterCells);
 }
 
 void PressWorld::SetBoundary(const glm::ivec2& position, bool boundary)
@@ -40,130 +58,323 @@ void PressWorld::SetBoundary(const glm::ivec2& position, bool boundary)
 	if (!IsPositionInBounds(position))
 		return;
 	
-	m_Boundaries[position.x][position.y] = boundary;
+	m_Boundaries(position.x, position.y) = boundary;
 	if (boundary)
-		m_WaterCells[position.x][position.y] = 0;
+		m_WaterCells(position.x, position.y) = 0;
+}
+BoundaryView PressWorld::GetBoundaryView() const
+{
+	return BoundaryView(m_Boundaries);
+}
+
+void PressWorld::SetWaterRegion(const Region& region, bool water)
+{
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int count = column.YEnd - column.YStart;
+
+		std::fill_n(m_WaterCells.GetLine(x) + column.YStart, count, water ? 1.f : 0.f);
+		if (water)
+		{
+			std::fill_n(m_Boundaries.GetLine(x) + column.YStart, count, false);
+			m_WetSpans[x] = m_WetSpans[x].Include({ column.YStart, column.YEnd });
+		}
+	}
+}
+
+void PressWorld::SetBoundaryRegion(const Region& region, bool boundary)
+{
+	for (int x = region.GetXStart(); x < region.GetXEnd(); ++x)
+	{
+		const Region::Column column = region.GetColumn(x);
+		const int count = column.YEnd - column.YStart;
+
+		std::fill_n(m_Boundaries.GetLine(x) + column.YStart, count, boundary);
+		if (boundary)
+			std::fill_n(m_WaterCells.GetLine(x) + column.YStart, count, 0.f);
+	}
+}
+
+void PressWorld::LoadPressures(const PressureView& pressures)
+{
+	const glm::ivec2 size = glm::min(pressures.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pWater = m_WaterCells.GetLine(x);
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pWater[y] = pressures(x, y);
+			if (pWater[y] > 0)
+				pBoundaries[y] = false;
+		}
+	}
+
+	FindWetSpans(0, size.x);
+}
+
+void PressWorld::LoadBoundaries(const BitmaskView& boundaries)
+{
+	const glm::ivec2 size = glm::min(boundaries.GetSize(), m_Size);
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pWater = m_WaterCells.GetLine(x);
+		bool* pBoundaries = m_Boundaries.GetLine(x);
+		for (int y = 0; y < size.y; ++y)
+		{
+			pBoundaries[y] = boundaries(x, y);
+			if (pBoundaries[y])
+				pWater[y] = 0;
+		}
+	}
 }
-std::vector<std::vector<bool>> PressWorld::GetBoundaries() const
+
+void PressWorld::WriteSnapshot(SnapshotWriter& writer) const
+{
+	writer.SetWorldType("PressWorld");
+	for (float PressFlowParams::* pParam : SnapshotParams)
+	{
+		writer.AddFloat(m_Params.*pParam);
+	}
+	writer.AddPlane(m_WaterCells);
+	writer.AddPlane(m_Boundaries);
+}
+
+bool PressWorld::ReadSnapshot(SnapshotReader& reader)
 {
-	return m_Boundaries;
+	if (!reader.IsWorldType("PressWorld"))
+		return false;
+
+	// Read aside first, the world only changes once the planes were read too
+	PressFlowParams params;
+	for (float PressFlowParams::* pParam : SnapshotParams)
+	{
+		if (!reader.ReadFloat(params.*pParam))
+			return false;
+	}
+
+	if (!reader.ReadPlanes(m_WaterCells, m_Boundaries))
+		return false;
+
+	m_Params = params;
+
+	FindWetSpans(0, m_Size.x);
+	return true;
 }
 
 void PressWorld::Update()
 {
-    m_NextWaterCells = m_WaterCells;
+    Update(1);
+}
 
-    //Calculate and apply flow for each cell
-    for (int x = 0; x < m_Size.x; x++)
+void PressWorld::Update(int steps)
+{
+#ifndef CA_GENERIC_PARAMS
+    if (m_Params == PressFlowParams{})
     {
-        for (int y = 0; y < m_Size.y; y++)
-        {
-            //Skip bounds
-            if (m_Boundaries[x][y])
-                continue;
+        Step(steps, m_ComputeDefaultFlows, DefaultPressFlowParams{});
+        return;
+    }
+#endif
 
-            // Skip small amount of water
-            if (m_WaterCells[x][y] < m_MinPressure)
-                continue;
+    Step(steps, m_ComputeFlows, m_Params);
+}
 
-            //Custom push-only flow
-            float remaining = m_WaterCells[x][y];
-            if (remaining <= 0)
-                continue;
+void PressWorld::SetParams(const PressFlowParams& params)
+{
+    m_Params = params;
+}
 
-            //The block below this one
-            if (IsPositionInBounds({x, y - 1}) && !m_Boundaries[x][y - 1])
-			{
-                float flow = GetStableState(remaining + m_WaterCells[x][y - 1]) - m_WaterCells[x][y - 1];
-                if (flow > m_MinFlow)
-                {
-                    flow *= 0.5f;
-                }
-                flow = std::clamp(flow, 0.f, std::min(m_MaxFlow, remaining));
-
-                m_NextWaterCells[x][y] -= flow;
-                m_NextWaterCells[x][y - 1] += flow;
-                remaining -= flow;
-            }
+const PressFlowParams& PressWorld::GetParams() const
+{
+    return m_Params;
+}
 
-            if (remaining <= 0)
-                continue;
+template<typename Params>
+void PressWorld::Step(int steps, ComputeFlowsFn<Params> computeFlows, const Params& params)
+{
+    m_StepStats.Reset();
+    ScopedPhaseTimer timer(m_StepStats, "Flow");
 
-            //Left
-            if (IsPositionInBounds({ x - 1, y }) && !m_Boundaries[x - 1][y])
-            {
-                //Equalize the amount of water in this block and it's neighbour
-                float flow = (m_WaterCells[x][y] - m_WaterCells[x - 1][y]) / 4;
-                if (flow > m_MinFlow)
-                {
-	                flow *= 0.5f;
-                }
-                flow = std::clamp(flow, 0.f, remaining);
-
-                m_NextWaterCells[x][y] -= flow;
-                m_NextWaterCells[x - 1][y] += flow;
-                remaining -= flow;
-            }
+    // Each step only reads the one before it, so several steps can be worked on in a single
+    // sweep over the world: while the first step does column x, the second does x - 2, the
+    // third x - 4, and so on. Only the first step reads the world and only the last one writes
+    // it, the steps in between pass their columns on through a few columns of scratch. As many
+    // steps are combined as fit in the cache together.
+    const size_t levelBytes = sizeof(float) * (3 * 4 + 3) * (static_cast<size_t>(m_Size.y) + 2);
+    const int maxLevels = static_cast<int>(std::clamp<size_t>(CacheBudget / levelBytes, 1, MaxLevels));
 
-            if (remaining <= 0)
-                continue;
+    while (steps > 0)
+    {
+        const int levels = std::min(steps, maxLevels);
+        SweepSteps(levels, computeFlows, params);
+        steps -= levels;
+    }
+}
 
-            //Right
-            if (IsPositionInBounds({ x + 1, y }) && !m_Boundaries[x + 1][y])
-            {
-                //Equalize the amount of water in this block and it's neighbour
-                float flow = (m_WaterCells[x][y] - m_WaterCells[x + 1][y]) / 4;
-                if (flow > m_MinFlow)
-                {
-	                flow *= 0.5f;
-                }
-                flow = std::clamp(flow, 0.f, remaining);
-
-                m_NextWaterCells[x][y] -= flow;
-                m_NextWaterCells[x + 1][y] += flow;
-                remaining -= flow;
-            }
+template<typename Params>
+void PressWorld::SweepSteps(int levels, ComputeFlowsFn<Params> computeFlows, const Params& params)
+{
+    while (static_cast<int>(m_Levels.size()) < levels)
+    {
+        StepLevel& level = m_Levels.emplace_back();
+        for (Grid2D<float>& flows : level.ColumnFlows)
+        {
+            flows = Grid2D<float>({ 4, m_Size.y + 2 }, 0);
+        }
+        level.Columns = Grid2D<float>({ 3, m_Size.y }, 0);
+    }
 
-            if (remaining <= 0) continue;
+    // Every cell pushes water based on the current state only, so the flows of a column can be
+    // computed before the cells around it are done. They are computed one column ahead, the
+    // column to the right has to know what flows into it from the left. A step can do column x
+    // as soon as the step before has done x + 2.
+    const int lag = 2;
+    for (int sweep = 0; sweep < m_Size.x + lag * (levels - 1); sweep++)
+    {
+        for (int level = 0; level < levels; level++)
+        {
+            const int x = sweep - lag * level;
+            if (x < 0 || x >= m_Size.x)
+                continue;
 
-            //Up. Only compressed water flows upwards.
-            if (IsPositionInBounds({ x, y + 1 }) && !m_Boundaries[x][y + 1])
+            if (x == 0)
             {
-                float flow = remaining - GetStableState(remaining + m_WaterCells[x][y + 1]);
-                if (flow > m_MinFlow)
-                {
-	                flow *= 0.5f;
-                }
-                flow = std::clamp(flow, 0.f, std::min(m_MaxFlow, remaining));
-
-                m_NextWaterCells[x][y] -= flow;
-                m_NextWaterCells[x][y + 1] += flow;
-                remaining -= flow;
+                ComputeColumnFlows(level, -1, computeFlows, params);
+                ComputeColumnFlows(level, 0, computeFlows, params);
             }
+
+            ComputeColumnFlows(level, x + 1, computeFlows, params);
+            ApplyColumnFlows(level, levels, x);
         }
     }
-    
-    m_WaterCells = m_NextWaterCells;
+
+    m_WaterCells.Swap(m_NextWaterCells);
+    m_WetSpans.swap(m_NextWetSpans);
 }
 
-bool PressWorld::IsPositionInBounds(const glm::ivec2& position) const
+const float* PressWorld::GetInputColumn(int level, int x) const
 {
-	return position.x >= 0 && position.x < m_Size.x&&
-		position.y >= 0 && position.y < m_Size.y;
+    return level == 0 ? m_WaterCells.GetLine(x) : m_Levels[level - 1].Columns.GetLine(x % 3);
+}
+
+float* PressWorld::GetOutputColumn(int level, int levels, int x)
+{
+    // The next step reads columns x - 2 to x, so three are enough
+    return level == levels - 1 ? m_NextWaterCells.GetLine(x) : m_Levels[level].Columns.GetLine(x % 3);
 }
 
-float PressWorld::GetStableState(float totalPressure) const
+const PressWorld::Span& PressWorld::GetInputSpan(int level, int x) const
 {
-    if (totalPressure <= 1)
+    return level == 0 ? m_WetSpans[x] : m_Levels[level - 1].ColumnSpans[x % 3];
+}
+
+PressWorld::Span& PressWorld::GetOutputSpan(int level, int levels, int x)
+{
+    return level == levels - 1 ? m_NextWetSpans[x] : m_Levels[level].ColumnSpans[x % 3];
+}
+
+void PressWorld::FindWetSpans(int xStart, int xEnd)
+{
+    for (int x = xStart; x < xEnd; x++)
     {
-        return 1;
+        m_WetSpans[x] = Span{ 0, m_Size.y }.Trim(m_WaterCells.GetLine(x));
     }
+}
+
+template<typename Params>
+void PressWorld::ComputeColumnFlows(int level, int x, ComputeFlowsFn<Params> computeFlows, const Params& params)
+{
+    StepLevel& stepLevel = m_Levels[level];
+    Grid2D<float>& flows = stepLevel.ColumnFlows[(x + 1) % 3];
+    Span& flowSpan = stepLevel.FlowSpans[(x + 1) % 3];
+
+    // Outside the world nothing flows
+    if (x < 0 || x >= m_Size.x)
+    {
+        if (!flowSpan.IsEmpty())
+            flows.Fill(0);
+        flowSpan = {};
+        return;
+    }
+
+    // Only wet cells push water. The rows around them are included, so no wet cell mistakes the
+    // end of the rows for the edge of the world, as are the flows left over from the column
+    // computed here before, to clear them.
+    const Span wet = GetInputSpan(level, x);
+    const Span rows = wet.Grow(m_Size.y).Include(flowSpan);
+    flowSpan = wet;
+    if (rows.IsEmpty())
+        return;
+
+    const bool hasLeft = x > 0;
+    const bool hasRight = x + 1 < m_Size.x;
+    const int y = rows.Start;
+    const PressFlowColumn column{
+        GetInputColumn(level, x) + y,
+        hasLeft ? GetInputColumn(level, x - 1) + y : nullptr,
+        hasRight ? GetInputColumn(level, x + 1) + y : nullptr,
+        m_Boundaries.GetLine(x) + y,
+        hasLeft ? m_Boundaries.GetLine(x - 1) + y : nullptr,
+        hasRight ? m_Boundaries.GetLine(x + 1) + y : nullptr,
+        rows.End - rows.Start,
+        flows.GetLine(FlowDown) + 1 + y,
+        flows.GetLine(FlowLeft) + 1 + y,
+        flows.GetLine(FlowRight) + 1 + y,
+        flows.GetLine(FlowUp) + 1 + y
+    };
+    computeFlows(column, params);
+}
 
-	if (totalPressure < 2 * m_MaxPressure + m_MaxCompression)
+void PressWorld::ApplyColumnFlows(int level, int levels, int x)
+{
+    // Water stays where it is, flows into the cells around its own column and into the same rows
+    // of the neighbouring columns. What was left in the output before has to be overwritten.
+    const StepLevel& stepLevel = m_Levels[level];
+    Span& nextSpan = GetOutputSpan(level, levels, x);
+    const Span rows = GetInputSpan(level, x)
+        .Include(stepLevel.FlowSpans[(x + 1) % 3].Grow(m_Size.y))
+        .Include(stepLevel.FlowSpans[x % 3])
+        .Include(stepLevel.FlowSpans[(x + 2) % 3])
+        .Include(nextSpan);
+    nextSpan = {};
+    if (rows.IsEmpty())
+        return;
+
+    m_StepStats.AddCells(rows.End - rows.Start);
+
+    const float* pWater = GetInputColumn(level, x);
+    float* pNextWater = GetOutputColumn(level, levels, x);
+
+    const float* pDown = GetFlows(level, x, FlowDown);
+    const float* pLeft = GetFlows(level, x, FlowLeft);
+    const float* pRight = GetFlows(level, x, FlowRight);
+    const float* pUp = GetFlows(level, x, FlowUp);
+    const float* pFromLeft = GetFlows(level, x - 1, FlowRight);
+    const float* pFromRight = GetFlows(level, x + 1, FlowLeft);
+
+    // Added up in the order the cells are visited, column by column from the bottom up,
+    // so the result matches pushing the water cell by cell
+    for (int y = rows.Start; y < rows.End; y++)
     {
-        return (powf(m_MaxPressure, 2) + totalPressure * m_MaxCompression) / (m_MaxPressure + m_MaxCompression);
+        pNextWater[y] = pWater[y] + pFromLeft[y] + pUp[y - 1]
+            - pDown[y] - pLeft[y] - pRight[y] - pUp[y]
+            + pDown[y + 1] + pFromRight[y];
     }
 
-    return (totalPressure + m_MaxCompression) / 2;
+    // Trimmed from both ends in a separate pass, so the loop above stays vectorized
+    nextSpan = rows.Trim(pNextWater);
 }
 
+const float* PressWorld::GetFlows(int level, int x, int direction) const
+{
+    // Skip the zero row below the column
+    return m_Levels[level].ColumnFlows[(x + 1) % 3].GetLine(direction) + 1;
+}
+
+bool PressWorld::IsPositionInBounds(const glm::ivec2& position) const
+{
+	return position.x >= 0 && position.x < m_Size.x&&
+		position.y >= 0 && position.y < m_Size.y;
+}
@@ -1,5 +1,11 @@
 #pragma once
 #include "World.h"
+#include "Grid2D.h"
+#include "PressFlowKernels.h"
+#include "RowSpan.h"
+
+#include <array>
+#include <vector>
 
 class PressWorld : public World
 {
@@ -8,25 +14,79 @@ public:
 	[[nodiscard]] glm::ivec2 GetSize() const override;
 
 	void SetWater(const glm::ivec2& position, bool water) override;
-	[[nodiscard]] std::vector<std::vector<float>> GetWaterPressures() const override;
+	[[nodiscard]] PressureView GetPressureView() const override;
 
 	void SetBoundary(const glm::ivec2& position, bool boundary) override;
-	[[nodiscard]] std::vector<std::vector<bool>> GetBoundaries() const override;
+	[[nodiscard]] BoundaryView GetBoundaryView() const override;
+
+	void SetWaterRegion(const Region& region, bool water) override;
+	void SetBoundaryRegion(const Region& region, bool boundary) override;
+	void LoadPressures(const PressureView& pressures) override;
+	void LoadBoundaries(const BitmaskView& boundaries) override;
+
+	void WriteSnapshot(SnapshotWriter& writer) const override;
+	[[nodiscard]] bool ReadSnapshot(SnapshotReader& reader) override;
 
 	void Update() override;
+	// Sweeps the world once for several steps at a time, the result is the same as stepping one by one
+	void Update(int steps) override;
+
+	// The constants the flow kernels step with, can be changed at runtime to experiment with them
+	void SetParams(const PressFlowParams& params);
+	[[nodiscard]] const PressFlowParams& GetParams() const;
 
 private:
+	// Lines of a column flow grid, the water pushed into each neighbour
+	static constexpr int FlowDown = 0;
+	static constexpr int FlowLeft = 1;
+	static constexpr int FlowRight = 2;
+	static constexpr int FlowUp = 3;
+
+	using Span = RowSpan;
+
+	// Scratch of one of the steps done in a sweep
+	struct StepLevel
+	{
+		// Flows of the columns x - 1, x and x + 1, with a zero row above and below every column
+		std::array<Grid2D<float>, 3> ColumnFlows;
+		std::array<Span, 3> FlowSpans;
+		// The last columns of water this step produced, column x in line x % 3
+		Grid2D<float> Columns;
+		std::array<Span, 3> ColumnSpans;
+	};
+
+	// Steps combined in one sweep are limited to what fits in this much cache
+	static constexpr size_t CacheBudget = 256 * 1024;
+	static constexpr size_t MaxLevels = 16;
+
 	bool IsPositionInBounds(const glm::ivec2& position) const;
-	float GetStableState(float totalPressure) const;
+	// The steps with the parameters either as PressFlowParams or as DefaultPressFlowParams
+	template<typename Params>
+	void Step(int steps, ComputeFlowsFn<Params> computeFlows, const Params& params);
+	template<typename Params>
+	void SweepSteps(int levels, ComputeFlowsFn<Params> computeFlows, const Params& params);
+	const float* GetInputColumn(int level, int x) const;
+	float* GetOutputColumn(int level, int levels, int x);
+	const Span& GetInputSpan(int level, int x) const;
+	Span& GetOutputSpan(int level, int levels, int x);
+	// After the water was changed without keeping the spans up to date
+	void FindWetSpans(int xStart, int xEnd);
+	template<typename Params>
+	void ComputeColumnFlows(int level, int x, ComputeFlowsFn<Params> computeFlows, const Params& params);
+	void ApplyColumnFlows(int level, int levels, int x);
+	const float* GetFlows(int level, int x, int direction) const;
 
-	std::vector<std::vector<float>> m_WaterCells;
-	std::vector<std::vector<float>> m_NextWaterCells;
-	std::vector<std::vector<bool>> m_Boundaries;
+	Grid2D<float> m_WaterCells;
+	Grid2D<float> m_NextWaterCells;
+	Grid2D<bool> m_Boundaries;
 	glm::ivec2 m_Size;
+	std::vector<Span> m_WetSpans;
+	std::vector<Span> m_NextWetSpans;
+
+	std::vector<StepLevel> m_Levels;
+	// Picked once for the CPU we are running on
+	ComputeFlowsFn<PressFlowParams> m_ComputeFlows;
+	ComputeFlowsFn<DefaultPressFlowParams> m_ComputeDefaultFlows;
 
-	const float m_MaxPressure = 1.0f;
-	const float m_MinPressure = 0.001f;
-	const float m_MaxCompression = 0.25f;
-	const float m_MinFlow = 0.01f;
-	const float m_MaxFlow = 1.25f;
+	PressFlowParams m_Params;
 };
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "Region.h"
+
+#include <algorithm>
+#include <cmath>
+
+Region Region::Rectangle(const glm::ivec2& min, const glm::ivec2& max, const glm::ivec2& worldSize)
+{
+	const glm::ivec2 clippedMin = glm::max(min, 0);
+	const glm::ivec2 clippedMax = glm::min(max, worldSize);
+
+	Region region;
+	region.m_XStart = clippedMin.x;
+	for (int x = clippedMin.x; x < clippedMax.x; ++x)
+	{
+		region.AddColumn(clippedMin.y, clippedMax.y);
+	}
+	return region;
+}
+
+Region Region::Circle(const glm::ivec2& center, int radius, const glm::ivec2& worldSize)
+{
+	const int xStart = std::max(center.x - radius, 0);
+	const int xEnd = std::min(center.x + radius + 1, worldSize.x);
+
+	Region region;
+	region.m_XStart = xStart;
+	for (int x = xStart; x < xEnd; ++x)
+	{
+		const int dx = x - center.x;
+		const int halfHeight = static_cast<int>(std::sqrt(static_cast<float>(radius * radius - dx * dx)));
+		region.AddColumn(std::max(center.y - halfHeight, 0), std::min(center.y + halfHeight + 1, worldSize.y));
+	}
+	return region;
+}
+
+bool Region::IsEmpty() const
+{
+	return m_YMin >= m_YMax;
+}
+
+int Region::GetXStart() const
+{
+	return m_XStart;
+}
+
+int Region::GetXEnd() const
+{
+	return m_XStart + static_cast<int>(m_Columns.size());
+}
+
+const Region::Column& Region::GetColumn(int x) const
+{
+	return m_Columns[x - m_XStart];
+}
+
+glm::ivec2 Region::GetMin() const
+{
+	return { m_XStart, m_YMin };
+}
+
+glm::ivec2 Region::GetMax() const
+{
+	return { GetXEnd(), m_YMax };
+}
+
+void Region::AddColumn(int yStart, int yEnd)
+{
+	yEnd = std::max(yEnd, yStart);
+	if (yStart < yEnd)
+	{
+		const bool wasEmpty = IsEmpty();
+		m_YMin = wasEmpty ? yStart : std::min(m_YMin, yStart);
+		m_YMax = wasEmpty ? yEnd : std::max(m_YMax, yEnd);
+	}
+
+	m_Columns.push_back({ yStart, yEnd });
+}
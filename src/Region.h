@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+// A set of cells with one run of rows per column, rectangles and circles both fit.
+// A region is clipped to the world it is made for, so worlds can apply it without bounds checks.
+class Region
+{
+public:
+	struct Column
+	{
+		int YStart;
+		int YEnd;
+	};
+
+	// Cells in [min, max)
+	static Region Rectangle(const glm::ivec2& min, const glm::ivec2& max, const glm::ivec2& worldSize);
+	// Cells whose center is at most radius away from the center
+	static Region Circle(const glm::ivec2& center, int radius, const glm::ivec2& worldSize);
+
+	[[nodiscard]] bool IsEmpty() const;
+
+	// Columns [XStart, XEnd), some of which can be empty
+	[[nodiscard]] int GetXStart() const;
+	[[nodiscard]] int GetXEnd() const;
+	[[nodiscard]] const Column& GetColumn(int x) const;
+
+	// Bounding box, [min, max)
+	[[nodiscard]] glm::ivec2 GetMin() const;
+	[[nodiscard]] glm::ivec2 GetMax() const;
+
+private:
+	void AddColumn(int yStart, int yEnd);
+
+	int m_XStart = 0;
+	std::vector<Column> m_Columns;
+	int m_YMin = 0;
+	int m_YMax = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <algorithm>
+
+// Rows [Start, End) of a column. The worlds keep one per column around their water, every
+// value of the column outside it is exactly 0. Only the rows around the water are visited, so
+// sparse worlds cost what their water does.
+struct RowSpan
+{
+	int Start = 0;
+	int End = 0;
+
+	[[nodiscard]] bool IsEmpty() const
+	{
+		return Start >= End;
+	}
+
+	[[nodiscard]] RowSpan Include(const RowSpan& other) const
+	{
+		if (other.IsEmpty())
+			return *this;
+		if (IsEmpty())
+			return other;
+		return { std::min(Start, other.Start), std::max(End, other.End) };
+	}
+
+	// One more row above and below, for a column of the given height
+	[[nodiscard]] RowSpan Grow(int height) const
+	{
+		if (IsEmpty())
+			return *this;
+		return { std::max(Start - 1, 0), std::min(End + 1, height) };
+	}
+
+	// The part of the span within the rows [start, end)
+	[[nodiscard]] RowSpan Clip(int start, int end) const
+	{
+		return { std::max(Start, start), std::min(End, end) };
+	}
+
+	// Without the zeros at either end of the span
+	[[nodiscard]] RowSpan Trim(const float* pValues) const
+	{
+		RowSpan span = *this;
+		while (!span.IsEmpty() && pValues[span.Start] == 0)
+			span.Start++;
+		while (!span.IsEmpty() && pValues[span.End - 1] == 0)
+			span.End--;
+		return span;
+	}
+};
@@ -0,0 +1,140 @@
+#include "SimulationThread.h"
+
+#include <cstring>
+
+SimulationThread::SimulationThread(World& world, std::chrono::nanoseconds tick)
+	: m_World(world)
+	, m_Tick(tick)
+{
+	for (Frame& frame : m_Frames)
+	{
+		frame.Pressures = Grid2D<float>(world.GetSize(), 0);
+		frame.Boundaries = Grid2D<bool>(world.GetSize(), false);
+	}
+
+	// The reader sees the world as it is until the first step is published
+	Publish();
+	m_ReadFrame = m_SharedFrame.exchange(m_ReadFrame) & ~NewFrameBit;
+}
+
+SimulationThread::~SimulationThread()
+{
+	Stop();
+}
+
+void SimulationThread::Start()
+{
+	if (m_Thread.joinable())
+		return;
+
+	m_Stop = false;
+	m_Thread = std::thread(&SimulationThread::SimulationLoop, this);
+}
+
+void SimulationThread::Stop()
+{
+	if (!m_Thread.joinable())
+		return;
+
+	m_Stop = true;
+	m_Thread.join();
+}
+
+void SimulationThread::PostEdit(const Edit& edit)
+{
+	std::lock_guard lock(m_EditMutex);
+	m_PendingEdits.push_back(edit);
+}
+
+const SimulationThread::Frame& SimulationThread::AcquireLatestFrame()
+{
+	// Hand the frame we held back and take the published one, if there is a newer one
+	if (m_SharedFrame.load(std::memory_order_relaxed) & NewFrameBit)
+		m_ReadFrame = m_SharedFrame.exchange(m_ReadFrame, std::memory_order_acq_rel) & ~NewFrameBit;
+
+	return m_Frames[m_ReadFrame];
+}
+
+uint64_t SimulationThread::GetStepCount() const
+{
+	return m_StepCount.load(std::memory_order_relaxed);
+}
+
+uint64_t SimulationThread::GetMissedTicks() const
+{
+	return m_MissedTicks.load(std::memory_order_relaxed);
+}
+
+void SimulationThread::SimulationLoop()
+{
+	auto nextTick = std::chrono::steady_clock::now();
+	while (!m_Stop.load(std::memory_order_relaxed))
+	{
+		ApplyEdits();
+		m_World.Update();
+		m_StepCount.fetch_add(1, std::memory_order_relaxed);
+		Publish();
+
+		if (m_Tick.count() == 0)
+			continue;
+
+		// A slow step delays the following ones instead of causing a burst of steps after it
+		nextTick += m_Tick;
+		const auto now = std::chrono::steady_clock::now();
+		if (now > nextTick)
+		{
+			m_MissedTicks.fetch_add((now - nextTick) / m_Tick, std::memory_order_relaxed);
+			nextTick = now;
+			continue;
+		}
+
+		std::this_thread::sleep_until(nextTick);
+	}
+}
+
+void SimulationThread::ApplyEdits()
+{
+	{
+		std::lock_guard lock(m_EditMutex);
+		m_Edits.swap(m_PendingEdits);
+	}
+
+	for (const Edit& edit : m_Edits)
+	{
+		if (edit.Boundary)
+			m_World.StampBoundary(edit.Center, edit.Radius, edit.Value);
+		else
+			m_World.StampWater(edit.Center, edit.Radius, edit.Value);
+	}
+	m_Edits.clear();
+}
+
+void SimulationThread::Publish()
+{
+	Frame& frame = m_Frames[m_WriteFrame];
+	const PressureView pressures = m_World.GetPressureView();
+	const BoundaryView boundaries = m_World.GetBoundaryView();
+	const glm::ivec2 size = m_World.GetSize();
+
+	for (int x = 0; x < size.x; ++x)
+	{
+		float* pPressures = frame.Pressures.GetLine(x);
+		bool* pBoundaries = frame.Boundaries.GetLine(x);
+		if (pressures.IsColumnContiguous() && boundaries.IsColumnContiguous())
+		{
+			std::memcpy(pPressures, &pressures(x, 0), sizeof(float) * size.y);
+			std::memcpy(pBoundaries, &boundaries(x, 0), sizeof(bool) * size.y);
+			continue;
+		}
+
+		for (int y = 0; y < size.y; ++y)
+		{
+			pPressures[y] = pressures(x, y);
+			pBoundaries[y] = boundaries(x, y);
+		}
+	}
+	frame.Step = m_StepCount.load(std::memory_order_relaxed);
+
+	// Swap the written frame with the shared one, the reader picks it up from there
+	m_WriteFrame = m_SharedFrame.exchange(m_WriteFrame | NewFrameBit, std::memory_order_acq_rel) & ~NewFrameBit;
+}
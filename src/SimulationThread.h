@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Grid2D.h"
+#include "World.h"
+
+// Runs a world on its own thread at a fixed tick, so slow frames don't slow the simulation down
+// and slow steps don't hold up presenting. After every step the pressures and boundaries are
+// published through a triple buffer: the simulation always has a frame to write, the reader
+// always has a complete frame to read, and neither ever waits for the other. Edits are queued
+// and applied between steps.
+class SimulationThread
+{
+public:
+	struct Frame
+	{
+		Grid2D<float> Pressures;
+		Grid2D<bool> Boundaries;
+		// Steps done before the frame was taken
+		uint64_t Step = 0;
+	};
+
+	struct Edit
+	{
+		glm::ivec2 Center;
+		int Radius;
+		bool Boundary;
+		bool Value;
+	};
+
+	// The world is only touched by the simulation thread until Stop(), a tick of 0 runs it as fast as it goes
+	SimulationThread(World& world, std::chrono::nanoseconds tick);
+	~SimulationThread();
+
+	SimulationThread(const SimulationThread& other) = delete;
+	SimulationThread(SimulationThread&& other) = delete;
+	SimulationThread& operator=(const SimulationThread& other) = delete;
+	SimulationThread& operator=(SimulationThread&& other) = delete;
+
+	void Start();
+	void Stop();
+
+	// Applied with StampWater() or StampBoundary() before the next step
+	void PostEdit(const Edit& edit);
+
+	// The most recently published frame, it stays untouched until the next call
+	[[nodiscard]] const Frame& AcquireLatestFrame();
+
+	[[nodiscard]] uint64_t GetStepCount() const;
+	// Ticks the simulation was too late for, it skips ahead instead of trying to catch up
+	[[nodiscard]] uint64_t GetMissedTicks() const;
+
+private:
+	// Set in the shared index when it holds a frame the reader has not seen yet
+	static constexpr uint8_t NewFrameBit = 4;
+
+	void SimulationLoop();
+	void ApplyEdits();
+	void Publish();
+
+	World& m_World;
+	std::chrono::nanoseconds m_Tick;
+	std::thread m_Thread;
+	std::atomic<bool> m_Stop = false;
+
+	Frame m_Frames[3];
+	// Frame the simulation writes, frame the reader holds, and the frame in between
+	uint8_t m_WriteFrame = 0;
+	uint8_t m_ReadFrame = 1;
+	alignas(64) std::atomic<uint8_t> m_SharedFrame = 2;
+
+	std::mutex m_EditMutex;
+	std::vector<Edit> m_Edits;
+	// Swapped with m_Edits, so edits can be posted while the previous ones are applied
+	std::vector<Edit> m_PendingEdits;
+
+	std::atomic<uint64_t> m_StepCount = 0;
+	std::atomic<uint64_t> m_MissedTicks = 0;
+};
@@ -0,0 +1,258 @@
+#include "Snapshot.h"
+#include "World.h"
+
+#include <bit>
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Plane data starts on a cache line, like the lines of a Grid2D
+	constexpr size_t PlaneAlignment = 64;
+
+	size_t AlignUp(size_t offset)
+	{
+		return (offset + PlaneAlignment - 1) / PlaneAlignment * PlaneAlignment;
+	}
+
+	size_t TableEnd(uint32_t valueCount, uint32_t planeCount)
+	{
+		return sizeof(SnapshotHeader) + sizeof(uint64_t) * valueCount + sizeof(SnapshotPlane) * planeCount;
+	}
+}
+
+SnapshotWriter::SnapshotWriter(const glm::ivec2& size, uint32_t seed)
+{
+	std::memcpy(m_Header.Magic, SnapshotHeader::MagicValue, sizeof(m_Header.Magic));
+	m_Header.Version = SnapshotHeader::CurrentVersion;
+	m_Header.Seed = seed;
+	m_Header.Width = size.x;
+	m_Header.Height = size.y;
+}
+
+void SnapshotWriter::SetWorldType(const char* pWorldType)
+{
+	std::memset(m_Header.WorldType, 0, sizeof(m_Header.WorldType));
+	std::strncpy(m_Header.WorldType, pWorldType, sizeof(m_Header.WorldType) - 1);
+}
+
+void SnapshotWriter::AddValue(uint64_t value)
+{
+	m_Values.push_back(value);
+}
+
+void SnapshotWriter::AddFloat(float value)
+{
+	AddValue(std::bit_cast<uint32_t>(value));
+}
+
+bool SnapshotWriter::Save(const std::string& path) const
+{
+	SnapshotHeader header = m_Header;
+	header.ValueCount = static_cast<uint32_t>(m_Values.size());
+	header.PlaneCount = static_cast<uint32_t>(m_Planes.size());
+
+	std::vector<SnapshotPlane> table;
+	size_t offset = AlignUp(TableEnd(header.ValueCount, header.PlaneCount));
+	for (const Plane& plane : m_Planes)
+	{
+		table.push_back({ plane.ElementSize, plane.Stride, plane.LineCount, offset });
+		offset = AlignUp(offset + plane.ElementSize * plane.Stride * plane.LineCount);
+	}
+
+	std::FILE* pFile = std::fopen(path.c_str(), "wb");
+	if (!pFile)
+		return false;
+
+	bool written = std::fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+		std::fwrite(m_Values.data(), sizeof(uint64_t), m_Values.size(), pFile) == m_Values.size() &&
+		std::fwrite(table.data(), sizeof(SnapshotPlane), table.size(), pFile) == table.size();
+
+	// Each grid is already one contiguous block, padding included
+	const std::byte padding[PlaneAlignment]{};
+	size_t position = TableEnd(header.ValueCount, header.PlaneCount);
+	for (size_t i = 0; i < m_Planes.size() && written; i++)
+	{
+		const size_t byteSize = m_Planes[i].ElementSize * m_Planes[i].Stride * m_Planes[i].LineCount;
+		const size_t paddingSize = static_cast<size_t>(table[i].Offset) - position;
+		written = std::fwrite(padding, 1, paddingSize, pFile) == paddingSize &&
+			std::fwrite(m_Planes[i].pData, 1, byteSize, pFile) == byteSize;
+		position = table[i].Offset + byteSize;
+	}
+
+	return std::fclose(pFile) == 0 && written;
+}
+
+SnapshotReader::~SnapshotReader()
+{
+	Close();
+}
+
+bool SnapshotReader::Open(const std::string& path)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	m_pFileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(SnapshotHeader)))
+	{
+		Close();
+		return false;
+	}
+	m_DataSize = static_cast<size_t>(fileSize.QuadPart);
+
+	m_pMappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_pMappingHandle)
+		m_pData = static_cast<const std::byte*>(MapViewOfFile(m_pMappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+	const int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size >= static_cast<off_t>(sizeof(SnapshotHeader)))
+	{
+		m_DataSize = static_cast<size_t>(fileStat.st_size);
+		void* pMapped = mmap(nullptr, m_DataSize, PROT_READ, MAP_PRIVATE, file, 0);
+		if (pMapped != MAP_FAILED)
+		{
+			// Every byte is read once, front to back
+			madvise(pMapped, m_DataSize, MADV_SEQUENTIAL);
+			m_pData = static_cast<const std::byte*>(pMapped);
+		}
+	}
+	// The mapping stays valid without the descriptor
+	close(file);
+#endif
+
+	if (!m_pData)
+	{
+		Close();
+		return false;
+	}
+
+	const SnapshotHeader& header = GetHeader();
+	if (std::memcmp(header.Magic, SnapshotHeader::MagicValue, sizeof(header.Magic)) != 0 ||
+		header.Version != SnapshotHeader::CurrentVersion ||
+		header.WorldType[sizeof(header.WorldType) - 1] != '\0' ||
+		m_DataSize < TableEnd(header.ValueCount, header.PlaneCount))
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void SnapshotReader::Close()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_pMappingHandle)
+		CloseHandle(m_pMappingHandle);
+	if (m_pFileHandle)
+		CloseHandle(m_pFileHandle);
+#else
+	if (m_pData)
+		munmap(const_cast<std::byte*>(m_pData), m_DataSize);
+#endif
+
+	m_pData = nullptr;
+	m_DataSize = 0;
+	m_pFileHandle = nullptr;
+	m_pMappingHandle = nullptr;
+	m_NextValue = 0;
+	m_NextPlane = 0;
+}
+
+const SnapshotHeader& SnapshotReader::GetHeader() const
+{
+	return *reinterpret_cast<const SnapshotHeader*>(m_pData);
+}
+
+bool SnapshotReader::IsWorldType(const char* pWorldType) const
+{
+	return std::strcmp(GetHeader().WorldType, pWorldType) == 0;
+}
+
+glm::ivec2 SnapshotReader::GetSize() const
+{
+	return { GetHeader().Width, GetHeader().Height };
+}
+
+bool SnapshotReader::ReadValue(uint64_t& value)
+{
+	if (m_NextValue >= GetHeader().ValueCount)
+		return false;
+
+	std::memcpy(&value, m_pData + sizeof(SnapshotHeader) + sizeof(uint64_t) * m_NextValue++, sizeof(value));
+	return true;
+}
+
+bool SnapshotReader::ReadFloat(float& value)
+{
+	uint64_t bits;
+	if (!ReadValue(bits))
+		return false;
+
+	value = std::bit_cast<float>(static_cast<uint32_t>(bits));
+	return true;
+}
+
+const void* SnapshotReader::NextPlane(size_t elementSize, size_t stride, size_t lineCount)
+{
+	const SnapshotHeader& header = GetHeader();
+	if (m_NextPlane >= header.PlaneCount)
+		return nullptr;
+
+	SnapshotPlane plane;
+	const size_t tableStart = sizeof(SnapshotHeader) + sizeof(uint64_t) * header.ValueCount;
+	std::memcpy(&plane, m_pData + tableStart + sizeof(SnapshotPlane) * m_NextPlane++, sizeof(plane));
+
+	// The grid has to have been saved with the same layout, and has to be in the file
+	if (plane.ElementSize != elementSize || plane.Stride != stride || plane.LineCount != lineCount ||
+		plane.Offset > m_DataSize || m_DataSize - plane.Offset < elementSize * stride * lineCount)
+	{
+		return nullptr;
+	}
+
+	return m_pData + plane.Offset;
+}
+
+bool SaveSnapshot(const World& world, const std::string& path)
+{
+	SnapshotWriter writer(world.GetSize(), world.GetSeed());
+	world.WriteSnapshot(writer);
+	return writer.Save(path);
+}
+
+bool LoadSnapshot(World& world, const std::string& path)
+{
+	SnapshotReader reader;
+	return reader.Open(path) && LoadSnapshot(world, reader);
+}
+
+bool LoadSnapshot(World& world, SnapshotReader& reader)
+{
+	if (reader.GetSize() != world.GetSize() || !world.ReadSnapshot(reader))
+		return false;
+
+	world.SetSeed(reader.GetHeader().Seed);
+	return true;
+}
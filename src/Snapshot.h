@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Grid2D.h"
+
+class World;
+
+// Versioned binary snapshot of a world. The header is followed by the world's scalar values and
+// then its grids, byte for byte as they are laid out in memory, each starting on a cache line.
+// Saving is one sequential write, loading maps the file and copies each grid out in one go.
+
+struct SnapshotHeader
+{
+	static constexpr char MagicValue[8] = { 'C', 'A', 'S', 'N', 'A', 'P', 0, 0 };
+	static constexpr uint32_t CurrentVersion = 3;
+
+	char Magic[8];
+	uint32_t Version;
+	uint32_t ValueCount;
+	uint32_t PlaneCount;
+	uint32_t Seed;
+	int32_t Width;
+	int32_t Height;
+	// Name of the World class, zero padded
+	char WorldType[32];
+};
+
+struct SnapshotPlane
+{
+	uint64_t ElementSize;
+	uint64_t Stride;
+	uint64_t LineCount;
+	// From the start of the file
+	uint64_t Offset;
+};
+
+class SnapshotWriter
+{
+public:
+	SnapshotWriter(const glm::ivec2& size, uint32_t seed);
+
+	void SetWorldType(const char* pWorldType);
+
+	// Values and grids are read back in the order they are added
+	void AddValue(uint64_t value);
+	// Stored by its bits, so it comes back exactly
+	void AddFloat(float value);
+
+	template<typename T, GridLayout Layout>
+	void AddPlane(const Grid2D<T, Layout>& grid)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Snapshot planes are copied byte for byte");
+		m_Planes.push_back({ grid.GetData(), sizeof(T), grid.GetStride(), grid.GetLineCount() });
+	}
+
+	[[nodiscard]] bool Save(const std::string& path) const;
+
+private:
+	struct Plane
+	{
+		const void* pData;
+		size_t ElementSize;
+		size_t Stride;
+		size_t LineCount;
+	};
+
+	SnapshotHeader m_Header{};
+	std::vector<uint64_t> m_Values;
+	std::vector<Plane> m_Planes;
+};
+
+class SnapshotReader
+{
+public:
+	SnapshotReader() = default;
+	~SnapshotReader();
+
+	SnapshotReader(const SnapshotReader& other) = delete;
+	SnapshotReader(SnapshotReader&& other) = delete;
+	SnapshotReader& operator=(const SnapshotReader& other) = delete;
+	SnapshotReader& operator=(SnapshotReader&& other) = delete;
+
+	// Maps the file, false when it can't be read or isn't a snapshot of this version
+	[[nodiscard]] bool Open(const std::string& path);
+	void Close();
+
+	[[nodiscard]] const SnapshotHeader& GetHeader() const;
+	[[nodiscard]] bool IsWorldType(const char* pWorldType) const;
+	[[nodiscard]] glm::ivec2 GetSize() const;
+
+	// Values and grids come back in the order they were added, false when the next one is
+	// missing or does not have the layout of the grid it is read into
+	[[nodiscard]] bool ReadValue(uint64_t& value);
+	[[nodiscard]] bool ReadFloat(float& value);
+
+	// Reads the next grids all or nothing: every plane is checked before the first one is
+	// copied, so a snapshot that doesn't match leaves all of the grids as they were
+	template<typename... Grids>
+	[[nodiscard]] bool ReadPlanes(Grids&... grids)
+	{
+		// Braced lists are evaluated in order, the planes are taken from the file one by one
+		const void* planes[] = { NextPlane(grids)... };
+		for (const void* pData : planes)
+		{
+			if (!pData)
+				return false;
+		}
+
+		size_t plane = 0;
+		(CopyPlane(grids, planes[plane++]), ...);
+		return true;
+	}
+
+private:
+	template<typename T, GridLayout Layout>
+	const void* NextPlane(const Grid2D<T, Layout>& grid)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Snapshot planes are copied byte for byte");
+		return NextPlane(sizeof(T), grid.GetStride(), grid.GetLineCount());
+	}
+
+	template<typename T, GridLayout Layout>
+	static void CopyPlane(Grid2D<T, Layout>& grid, const void* pData)
+	{
+		std::memcpy(grid.GetData(), pData, sizeof(T) * grid.GetStride() * grid.GetLineCount());
+	}
+
+	const void* NextPlane(size_t elementSize, size_t stride, size_t lineCount);
+
+	const std::byte* m_pData = nullptr;
+	size_t m_DataSize = 0;
+	// Platform handles of the mapping
+	void* m_pFileHandle = nullptr;
+	void* m_pMappingHandle = nullptr;
+
+	uint32_t m_NextValue = 0;
+	uint32_t m_NextPlane = 0;
+};
+
+// Writes the world to a snapshot file
+[[nodiscard]] bool SaveSnapshot(const World& world, const std::string& path);
+// Restores a snapshot of a world of the same type and size, the world is left as it was when
+// the type or size differ or the snapshot is missing something the world needs
+[[nodiscard]] bool LoadSnapshot(World& world, const std::string& path);
+[[nodiscard]] bool LoadSnapshot(World& world, SnapshotReader& reader);
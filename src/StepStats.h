@@ -0,0 +1,131 @@
+#pragma once
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// Where the time of the last update call went. Only collected when built with CA_STEP_STATS,
+// otherwise everything below is empty and compiles away.
+struct StepStats
+{
+	struct Phase
+	{
+		// A phase called "A/B" is part of phase "A"
+		const char* pName;
+		long long Nanoseconds;
+	};
+
+	struct Thread
+	{
+		long long BusyNanoseconds = 0;
+		// Time the thread spent waiting for work or for the other threads to finish
+		long long WaitNanoseconds = 0;
+	};
+
+	std::vector<Phase> Phases;
+	std::vector<Thread> Threads;
+	long long CellsProcessed = 0;
+
+	static constexpr bool Enabled =
+#ifdef CA_STEP_STATS
+		true;
+#else
+		false;
+#endif
+
+	void Reset()
+	{
+		if constexpr (Enabled)
+		{
+			Phases.clear();
+			Threads.clear();
+			CellsProcessed = 0;
+		}
+	}
+
+	void AddPhase([[maybe_unused]] const char* pName, [[maybe_unused]] long long nanoseconds)
+	{
+		if constexpr (Enabled)
+		{
+			for (Phase& phase : Phases)
+			{
+				if (std::strcmp(phase.pName, pName) == 0)
+				{
+					phase.Nanoseconds += nanoseconds;
+					return;
+				}
+			}
+			Phases.push_back({ pName, nanoseconds });
+		}
+	}
+
+	void AddCells([[maybe_unused]] long long count)
+	{
+		if constexpr (Enabled)
+			CellsProcessed += count;
+	}
+
+	// Adds the stats of another step to these
+	void Add([[maybe_unused]] const StepStats& other)
+	{
+		if constexpr (Enabled)
+		{
+			for (const Phase& phase : other.Phases)
+			{
+				AddPhase(phase.pName, phase.Nanoseconds);
+			}
+
+			if (Threads.size() < other.Threads.size())
+				Threads.resize(other.Threads.size());
+			for (size_t i = 0; i < other.Threads.size(); i++)
+			{
+				Threads[i].BusyNanoseconds += other.Threads[i].BusyNanoseconds;
+				Threads[i].WaitNanoseconds += other.Threads[i].WaitNanoseconds;
+			}
+
+			CellsProcessed += other.CellsProcessed;
+		}
+	}
+};
+
+// Adds the time until the end of the scope, or until Next(), to a phase
+class ScopedPhaseTimer
+{
+public:
+#ifdef CA_STEP_STATS
+	ScopedPhaseTimer(StepStats& stats, const char* pPhase)
+		: m_Stats(stats)
+		, m_pPhase(pPhase)
+		, m_Start(std::chrono::steady_clock::now())
+	{}
+	~ScopedPhaseTimer()
+	{
+		Next(nullptr);
+	}
+
+	// Ends the current phase and starts timing the next one
+	void Next(const char* pPhase)
+	{
+		const auto end = std::chrono::steady_clock::now();
+		if (m_pPhase)
+			m_Stats.AddPhase(m_pPhase, std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_Start).count());
+
+		m_pPhase = pPhase;
+		m_Start = end;
+	}
+#else
+	ScopedPhaseTimer(StepStats&, const char*) {}
+	void Next(const char*) {}
+#endif
+
+	ScopedPhaseTimer(const ScopedPhaseTimer& other) = delete;
+	ScopedPhaseTimer(ScopedPhaseTimer&& other) = delete;
+	ScopedPhaseTimer& operator=(const ScopedPhaseTimer& other) = delete;
+	ScopedPhaseTimer& operator=(ScopedPhaseTimer&& other) = delete;
+
+#ifdef CA_STEP_STATS
+private:
+	StepStats& m_Stats;
+	const char* m_pPhase;
+	std::chrono::steady_clock::time_point m_Start;
+#endif
+};
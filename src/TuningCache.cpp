@@ -0,0 +1,75 @@
+#include "TuningCache.h"
+
+#include <cerrno>
+#include <cstdio>
+
+bool TuningCache::Load(const std::string& path)
+{
+	m_Entries.clear();
+
+	std::FILE* pFile = std::fopen(path.c_str(), "r");
+	if (!pFile)
+		return errno == ENOENT;
+
+	char line[256];
+	while (std::fgets(line, sizeof(line), pFile))
+	{
+		char worldType[64];
+		Entry entry;
+		if (std::sscanf(line, "%63s %d %d %d %d %d %lld", worldType, &entry.Size.x, &entry.Size.y, &entry.AvailableThreads,
+			&entry.Best.ThreadCount, &entry.Best.TileSize, &entry.Best.StepNanoseconds) != 7)
+		{
+			continue;
+		}
+
+		entry.WorldType = worldType;
+		m_Entries.push_back(entry);
+	}
+
+	std::fclose(pFile);
+	return true;
+}
+
+bool TuningCache::Save(const std::string& path) const
+{
+	std::FILE* pFile = std::fopen(path.c_str(), "w");
+	if (!pFile)
+		return false;
+
+	bool ok = true;
+	for (const Entry& entry : m_Entries)
+	{
+		ok &= std::fprintf(pFile, "%s %d %d %d %d %d %lld\n", entry.WorldType.c_str(), entry.Size.x, entry.Size.y, entry.AvailableThreads,
+			entry.Best.ThreadCount, entry.Best.TileSize, entry.Best.StepNanoseconds) > 0;
+	}
+
+	return std::fclose(pFile) == 0 && ok;
+}
+
+bool TuningCache::Find(const std::string& worldType, const glm::ivec2& size, int availableThreads, Config& config) const
+{
+	for (const Entry& entry : m_Entries)
+	{
+		if (entry.WorldType == worldType && entry.Size == size && entry.AvailableThreads == availableThreads)
+		{
+			config = entry.Best;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TuningCache::Store(const std::string& worldType, const glm::ivec2& size, int availableThreads, const Config& config)
+{
+	for (Entry& entry : m_Entries)
+	{
+		if (entry.WorldType == worldType && entry.Size == size && entry.AvailableThreads == availableThreads)
+		{
+			entry.Best = config;
+			return;
+		}
+	}
+
+	m_Entries.push_back({ worldType, size, availableThreads, config });
+}
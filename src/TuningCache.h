@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Configurations found by timing worlds on this machine, kept in a text file so later runs don't
+// have to time them again. Each line holds one configuration:
+//   <world type> <width> <height> <available threads> <thread count> <tile size> <step ns>
+// The available threads are those of the scheduler the world was tuned with.
+class TuningCache
+{
+public:
+	struct Config
+	{
+		int ThreadCount;
+		int TileSize;
+		// Median step time the configuration was picked with
+		long long StepNanoseconds;
+	};
+
+	// A missing file is an empty cache, lines that don't parse are skipped
+	[[nodiscard]] bool Load(const std::string& path);
+	[[nodiscard]] bool Save(const std::string& path) const;
+
+	[[nodiscard]] bool Find(const std::string& worldType, const glm::ivec2& size, int availableThreads, Config& config) const;
+	// Replaces the configuration stored for the same key
+	void Store(const std::string& worldType, const glm::ivec2& size, int availableThreads, const Config& config);
+
+private:
+	struct Entry
+	{
+		std::string WorldType;
+		glm::ivec2 Size;
+		int AvailableThreads;
+		Config Best;
+	};
+
+	std::vector<Entry> m_Entries;
+};
@@ -0,0 +1,166 @@
+#include "VelocityKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "CpuFeatures.h"
+
+#ifdef CPU_SSE2
+#include <emmintrin.h>
+#endif
+
+template<typename Params>
+float UpdateVelocitiesScalar(const VelocityColumn& column, int yStart, int yEnd, const Params& params)
+{
+	const float dragFactor = 1 - params.Drag;
+	const float k = params.FlowDueToPressure;
+	float activity = 0;
+
+	for (int y = yStart; y < yEnd; ++y)
+	{
+		const float startX = column.pVelocityX[y];
+		const float startY = column.pVelocityY[y];
+
+		// Drag and gravity
+		float velocityX = startX * dragFactor;
+		float velocityY = startY * dragFactor + params.Gravity;
+
+		// Pressure diff
+		if (!column.pBoundary[y])
+		{
+			const float pressure = column.pPressure[y];
+
+			if (y + 1 < column.Height && !column.pBoundary[y + 1])
+				velocityY = velocityY + (pressure - column.pPressure[y + 1]) * k;
+
+			if (y > 0 && !column.pBoundary[y - 1])
+				velocityY = velocityY - (pressure - column.pPressure[y - 1]) * k;
+
+			if (column.pPressureRight && !column.pBoundaryRight[y])
+				velocityX = velocityX + (pressure - column.pPressureRight[y]) * k;
+
+			if (column.pPressureLeft && !column.pBoundaryLeft[y])
+				velocityX = velocityX - (pressure - column.pPressureLeft[y]) * k;
+
+			// Settled water keeps the same velocity from step to step
+			if (pressure >= params.MinPressure)
+				activity = std::max(activity, std::abs(velocityX - startX) + std::abs(velocityY - startY));
+		}
+
+		column.pVelocityX[y] = velocityX;
+		column.pVelocityY[y] = velocityY;
+	}
+
+	return activity;
+}
+
+#ifdef CPU_SSE2
+namespace
+{
+	// All bits set in the lanes whose cell is not a boundary
+	__m128 LoadOpenMask(const bool* pBoundary)
+	{
+		int32_t bytes;
+		std::memcpy(&bytes, pBoundary, sizeof(bytes));
+
+		const __m128i zero = _mm_setzero_si128();
+		__m128i lanes = _mm_cvtsi32_si128(bytes);
+		lanes = _mm_unpacklo_epi8(lanes, zero);
+		lanes = _mm_unpacklo_epi16(lanes, zero);
+		return _mm_castsi128_ps(_mm_cmpeq_epi32(lanes, zero));
+	}
+
+	__m128 Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+}
+
+template<typename Params>
+float UpdateVelocitiesSse2(const VelocityColumn& column, int yStart, int yEnd, const Params& params)
+{
+	// The first and last row miss a neighbour, they go through the scalar kernel
+	const int vectorStart = std::min(std::max(yStart, 1), yEnd);
+	const int vectorEnd = vectorStart + (std::max(std::min(yEnd, column.Height - 1) - vectorStart, 0) / 4) * 4;
+
+	float activity = UpdateVelocitiesScalar(column, yStart, vectorStart, params);
+
+	const __m128 dragFactor = _mm_set1_ps(1 - params.Drag);
+	const __m128 gravity = _mm_set1_ps(params.Gravity);
+	const __m128 k = _mm_set1_ps(params.FlowDueToPressure);
+	const __m128 minPressure = _mm_set1_ps(params.MinPressure);
+	const __m128 signMask = _mm_set1_ps(-0.f);
+	__m128 maxChange = _mm_setzero_ps();
+
+	for (int y = vectorStart; y < vectorEnd; y += 4)
+	{
+		const __m128 startX = _mm_loadu_ps(column.pVelocityX + y);
+		const __m128 startY = _mm_loadu_ps(column.pVelocityY + y);
+		const __m128 pressure = _mm_loadu_ps(column.pPressure + y);
+		const __m128 open = LoadOpenMask(column.pBoundary + y);
+
+		// Drag and gravity
+		__m128 velocityX = _mm_mul_ps(startX, dragFactor);
+		__m128 velocityY = _mm_add_ps(_mm_mul_ps(startY, dragFactor), gravity);
+
+		// Pressure diff
+		__m128 flow = _mm_mul_ps(_mm_sub_ps(pressure, _mm_loadu_ps(column.pPressure + y + 1)), k);
+		velocityY = Select(_mm_and_ps(open, LoadOpenMask(column.pBoundary + y + 1)), _mm_add_ps(velocityY, flow), velocityY);
+
+		flow = _mm_mul_ps(_mm_sub_ps(pressure, _mm_loadu_ps(column.pPressure + y - 1)), k);
+		velocityY = Select(_mm_and_ps(open, LoadOpenMask(column.pBoundary + y - 1)), _mm_sub_ps(velocityY, flow), velocityY);
+
+		if (column.pPressureRight)
+		{
+			flow = _mm_mul_ps(_mm_sub_ps(pressure, _mm_loadu_ps(column.pPressureRight + y)), k);
+			velocityX = Select(_mm_and_ps(open, LoadOpenMask(column.pBoundaryRight + y)), _mm_add_ps(velocityX, flow), velocityX);
+		}
+
+		if (column.pPressureLeft)
+		{
+			flow = _mm_mul_ps(_mm_sub_ps(pressure, _mm_loadu_ps(column.pPressureLeft + y)), k);
+			velocityX = Select(_mm_and_ps(open, LoadOpenMask(column.pBoundaryLeft + y)), _mm_sub_ps(velocityX, flow), velocityX);
+		}
+
+		// Settled water keeps the same velocity from step to step
+		const __m128 change = _mm_add_ps(
+			_mm_andnot_ps(signMask, _mm_sub_ps(velocityX, startX)),
+			_mm_andnot_ps(signMask, _mm_sub_ps(velocityY, startY)));
+		const __m128 wet = _mm_and_ps(open, _mm_cmpge_ps(pressure, minPressure));
+		maxChange = _mm_max_ps(maxChange, _mm_and_ps(wet, change));
+
+		_mm_storeu_ps(column.pVelocityX + y, velocityX);
+		_mm_storeu_ps(column.pVelocityY + y, velocityY);
+	}
+
+	maxChange = _mm_max_ps(maxChange, _mm_shuffle_ps(maxChange, maxChange, _MM_SHUFFLE(1, 0, 3, 2)));
+	maxChange = _mm_max_ps(maxChange, _mm_shuffle_ps(maxChange, maxChange, _MM_SHUFFLE(2, 3, 0, 1)));
+	activity = std::max(activity, _mm_cvtss_f32(maxChange));
+
+	return std::max(activity, UpdateVelocitiesScalar(column, vectorEnd, yEnd, params));
+}
+#endif
+
+template<typename Params>
+UpdateVelocitiesFn<Params> SelectUpdateVelocities()
+{
+	const SimdLevel level = GetSimdLevel();
+	if (level >= SimdLevel::Avx2)
+		return UpdateVelocitiesAvx2<Params>;
+
+#ifdef CPU_SSE2
+	if (level >= SimdLevel::Sse2)
+		return UpdateVelocitiesSse2<Params>;
+#endif
+	return UpdateVelocitiesScalar<Params>;
+}
+
+template float UpdateVelocitiesScalar(const VelocityColumn&, int, int, const VelocityParams&);
+template float UpdateVelocitiesScalar(const VelocityColumn&, int, int, const DefaultVelocityParams&);
+#ifdef CPU_SSE2
+template float UpdateVelocitiesSse2(const VelocityColumn&, int, int, const VelocityParams&);
+template float UpdateVelocitiesSse2(const VelocityColumn&, int, int, const DefaultVelocityParams&);
+#endif
+template UpdateVelocitiesFn<VelocityParams> SelectUpdateVelocities();
+template UpdateVelocitiesFn<DefaultVelocityParams> SelectUpdateVelocities();
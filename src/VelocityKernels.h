@@ -0,0 +1,53 @@
+#pragma once
+
+// Velocity update of PressVelWorld: drag, gravity and the pressure gradient towards the
+// four neighbours. The vectorized versions give bit-identical results to the scalar one.
+
+struct VelocityParams
+{
+	float Drag;
+	float Gravity;
+	float FlowDueToPressure;
+	float MinPressure;
+};
+
+// PressVelWorld's defaults as compile time constants. The kernels are instantiated for these
+// and for VelocityParams, the instantiations for the defaults have the constants folded in.
+struct DefaultVelocityParams
+{
+	static constexpr float Drag = 0.1f;
+	static constexpr float Gravity = -0.1f;
+	static constexpr float FlowDueToPressure = 0.05f;
+	static constexpr float MinPressure = 0.001f;
+};
+
+// One column of the world. The left and right pointers are null at the edge of the world.
+struct VelocityColumn
+{
+	float* pVelocityX;
+	float* pVelocityY;
+	const float* pPressure;
+	const float* pPressureLeft;
+	const float* pPressureRight;
+	const bool* pBoundary;
+	const bool* pBoundaryLeft;
+	const bool* pBoundaryRight;
+	int Height;
+};
+
+// Updates the cells [yStart, yEnd) of a column and returns the largest velocity change
+// of a cell holding water
+template<typename Params>
+using UpdateVelocitiesFn = float(*)(const VelocityColumn& column, int yStart, int yEnd, const Params& params);
+
+// Defined and instantiated in the kernel files only, so the AVX2 file never compiles its own copy of the others
+template<typename Params>
+float UpdateVelocitiesScalar(const VelocityColumn& column, int yStart, int yEnd, const Params& params);
+template<typename Params>
+float UpdateVelocitiesSse2(const VelocityColumn& column, int yStart, int yEnd, const Params& params);
+template<typename Params>
+float UpdateVelocitiesAvx2(const VelocityColumn& column, int yStart, int yEnd, const Params& params);
+
+// Best kernel for the CPU the program is running on
+template<typename Params>
+[[nodiscard]] UpdateVelocitiesFn<Params> SelectUpdateVelocities();
@@ -0,0 +1,100 @@
+// Compiled with AVX2 enabled, only called after SelectUpdateVelocities() checked the CPU.
+// Keep this file free of inline functions shared with other files, the linker could pick
+// the AVX2 copy for code that runs on any CPU.
+#include "VelocityKernels.h"
+#include "CpuFeatures.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+
+namespace
+{
+	// All bits set in the lanes whose cell is not a boundary
+	__m256 LoadOpenMask(const bool* pBoundary)
+	{
+		const __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pBoundary)));
+		return _mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, _mm256_setzero_si256()));
+	}
+
+	float Max(float a, float b)
+	{
+		return a < b ? b : a;
+	}
+}
+
+template<typename Params>
+float UpdateVelocitiesAvx2(const VelocityColumn& column, int yStart, int yEnd, const Params& params)
+{
+	// The first and last row miss a neighbour, they go through the scalar kernel
+	int vectorStart = yStart < 1 ? 1 : yStart;
+	vectorStart = vectorStart < yEnd ? vectorStart : yEnd;
+	const int interiorEnd = yEnd < column.Height - 1 ? yEnd : column.Height - 1;
+	const int vectorEnd = vectorStart + (interiorEnd > vectorStart ? (interiorEnd - vectorStart) / 8 * 8 : 0);
+
+	float activity = UpdateVelocitiesScalar(column, yStart, vectorStart, params);
+
+	const __m256 dragFactor = _mm256_set1_ps(1 - params.Drag);
+	const __m256 gravity = _mm256_set1_ps(params.Gravity);
+	const __m256 k = _mm256_set1_ps(params.FlowDueToPressure);
+	const __m256 minPressure = _mm256_set1_ps(params.MinPressure);
+	const __m256 signMask = _mm256_set1_ps(-0.f);
+	__m256 maxChange = _mm256_setzero_ps();
+
+	for (int y = vectorStart; y < vectorEnd; y += 8)
+	{
+		const __m256 startX = _mm256_loadu_ps(column.pVelocityX + y);
+		const __m256 startY = _mm256_loadu_ps(column.pVelocityY + y);
+		const __m256 pressure = _mm256_loadu_ps(column.pPressure + y);
+		const __m256 open = LoadOpenMask(column.pBoundary + y);
+
+		// Drag and gravity, kept as separate multiplies and adds to match the scalar kernel
+		__m256 velocityX = _mm256_mul_ps(startX, dragFactor);
+		__m256 velocityY = _mm256_add_ps(_mm256_mul_ps(startY, dragFactor), gravity);
+
+		// Pressure diff
+		__m256 flow = _mm256_mul_ps(_mm256_sub_ps(pressure, _mm256_loadu_ps(column.pPressure + y + 1)), k);
+		velocityY = _mm256_blendv_ps(velocityY, _mm256_add_ps(velocityY, flow), _mm256_and_ps(open, LoadOpenMask(column.pBoundary + y + 1)));
+
+		flow = _mm256_mul_ps(_mm256_sub_ps(pressure, _mm256_loadu_ps(column.pPressure + y - 1)), k);
+		velocityY = _mm256_blendv_ps(velocityY, _mm256_sub_ps(velocityY, flow), _mm256_and_ps(open, LoadOpenMask(column.pBoundary + y - 1)));
+
+		if (column.pPressureRight)
+		{
+			flow = _mm256_mul_ps(_mm256_sub_ps(pressure, _mm256_loadu_ps(column.pPressureRight + y)), k);
+			velocityX = _mm256_blendv_ps(velocityX, _mm256_add_ps(velocityX, flow), _mm256_and_ps(open, LoadOpenMask(column.pBoundaryRight + y)));
+		}
+
+		if (column.pPressureLeft)
+		{
+			flow = _mm256_mul_ps(_mm256_sub_ps(pressure, _mm256_loadu_ps(column.pPressureLeft + y)), k);
+			velocityX = _mm256_blendv_ps(velocityX, _mm256_sub_ps(velocityX, flow), _mm256_and_ps(open, LoadOpenMask(column.pBoundaryLeft + y)));
+		}
+
+		// Settled water keeps the same velocity from step to step
+		const __m256 change = _mm256_add_ps(
+			_mm256_andnot_ps(signMask, _mm256_sub_ps(velocityX, startX)),
+			_mm256_andnot_ps(signMask, _mm256_sub_ps(velocityY, startY)));
+		const __m256 wet = _mm256_and_ps(open, _mm256_cmp_ps(pressure, minPressure, _CMP_GE_OQ));
+		maxChange = _mm256_max_ps(maxChange, _mm256_and_ps(wet, change));
+
+		_mm256_storeu_ps(column.pVelocityX + y, velocityX);
+		_mm256_storeu_ps(column.pVelocityY + y, velocityY);
+	}
+
+	__m128 half = _mm_max_ps(_mm256_castps256_ps128(maxChange), _mm256_extractf128_ps(maxChange, 1));
+	half = _mm_max_ps(half, _mm_shuffle_ps(half, half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_max_ps(half, _mm_shuffle_ps(half, half, _MM_SHUFFLE(2, 3, 0, 1)));
+	activity = Max(activity, _mm_cvtss_f32(half));
+
+	return Max(activity, UpdateVelocitiesScalar(column, vectorEnd, yEnd, params));
+}
+#else
+template<typename Params>
+float UpdateVelocitiesAvx2(const VelocityColumn& column, int yStart, int yEnd, const Params& params)
+{
+	return UpdateVelocitiesScalar(column, yStart, yEnd, params);
+}
+#endif
+
+template float UpdateVelocitiesAvx2(const VelocityColumn&, int, int, const VelocityParams&);
+template float UpdateVelocitiesAvx2(const VelocityColumn&, int, int, const DefaultVelocityParams&);
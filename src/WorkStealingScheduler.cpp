@@ -0,0 +1,298 @@
+#include "WorkStealingScheduler.h"
+
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef CPU_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+	std::mutex g_SharedMutex;
+	std::shared_ptr<WorkStealingScheduler> g_pShared;
+
+	void CpuRelax()
+	{
+#ifdef CPU_SSE2
+		_mm_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	void PinThread([[maybe_unused]] std::thread& thread, [[maybe_unused]] int cpu)
+	{
+#ifdef _WIN32
+		if (cpu < 64)
+			SetThreadAffinityMask(thread.native_handle(), static_cast<DWORD_PTR>(1) << cpu);
+#elif defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#endif
+	}
+}
+
+WorkStealingScheduler::WorkStealingScheduler(int threadCount, Affinity affinity)
+	: m_ThreadCount(std::clamp(threadCount, 1, static_cast<int>(ThreadCountMask)))
+	, m_SpinCount(m_ThreadCount <= static_cast<int>(std::thread::hardware_concurrency()) ? MaxSpinCount : 0)
+	, m_Workers(std::make_unique<Worker[]>(m_ThreadCount))
+{
+	const int cpuCount = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+	for (int i = 1; i < m_ThreadCount; i++)
+	{
+		m_Threads.emplace_back(&WorkStealingScheduler::WorkerLoop, this, i);
+		if (affinity == Affinity::PinToCores)
+			PinThread(m_Threads.back(), i % cpuCount);
+	}
+}
+
+WorkStealingScheduler::~WorkStealingScheduler()
+{
+	m_Stop.store(true);
+	m_Batch.fetch_add(1u << BatchShift);
+	m_Batch.notify_all();
+
+	for (std::thread& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+std::shared_ptr<WorkStealingScheduler> WorkStealingScheduler::GetShared()
+{
+	std::lock_guard lk(g_SharedMutex);
+	if (!g_pShared)
+		g_pShared = std::make_shared<WorkStealingScheduler>(static_cast<int>(std::thread::hardware_concurrency()));
+	return g_pShared;
+}
+
+void WorkStealingScheduler::SetShared(std::shared_ptr<WorkStealingScheduler> pScheduler)
+{
+	std::lock_guard lk(g_SharedMutex);
+	g_pShared = std::move(pScheduler);
+}
+
+int WorkStealingScheduler::GetThreadCount() const
+{
+	return m_ThreadCount;
+}
+
+void WorkStealingScheduler::Run(int taskCount, const Job& job, int maxThreads)
+{
+	if (taskCount <= 0)
+		return;
+
+	const int workerCount = std::min({ maxThreads > 0 ? maxThreads : m_ThreadCount, m_ThreadCount, taskCount });
+	if (workerCount == 1)
+	{
+		// Nothing to share, so the workers are left alone and other batches go on meanwhile
+		RunInline(taskCount, job);
+		return;
+	}
+
+	std::lock_guard runLk(m_RunMutex);
+
+#ifdef CA_STEP_STATS
+	const auto batchStart = std::chrono::steady_clock::now();
+#endif
+
+	// Hand out contiguous blocks so neighbouring tasks stay on the same thread
+	for (int i = 0; i < workerCount; i++)
+	{
+		const uint32_t begin = static_cast<uint32_t>(static_cast<int64_t>(taskCount) * i / workerCount);
+		const uint32_t end = static_cast<uint32_t>(static_cast<int64_t>(taskCount) * (i + 1) / workerCount);
+		m_Workers[i].Tasks.store(PackRange(begin, end), std::memory_order_relaxed);
+	}
+	m_pJob = &job;
+	m_BusyWorkers.store(workerCount - 1, std::memory_order_relaxed);
+
+	// Publishes the tasks and the job along with the new batch
+	const uint32_t batch = (m_Batch.load(std::memory_order_relaxed) >> BatchShift) + 1;
+	m_Batch.store(batch << BatchShift | static_cast<uint32_t>(workerCount));
+	if (m_SleepingWorkers.load() > 0)
+		m_Batch.notify_all();
+
+	RunTasks(0, workerCount);
+
+	int busyWorkers = m_BusyWorkers.load(std::memory_order_acquire);
+	while (busyWorkers != 0)
+	{
+		busyWorkers = WaitWhileEqual(m_BusyWorkers, busyWorkers, m_SleepingCallers);
+	}
+	m_pJob = nullptr;
+
+#ifdef CA_STEP_STATS
+	// Whatever part of the batch a thread was not running tasks, it was waiting
+	const long long batchNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - batchStart).count();
+	for (int i = 0; i < workerCount; i++)
+	{
+		Worker& worker = m_Workers[i];
+		worker.Times.BusyNanoseconds += worker.BatchBusyNanoseconds;
+		worker.Times.WaitNanoseconds += std::max(batchNanoseconds - worker.BatchBusyNanoseconds, 0LL);
+		worker.BatchBusyNanoseconds = 0;
+	}
+#endif
+}
+
+void WorkStealingScheduler::RunInline(int taskCount, const Job& job)
+{
+#ifdef CA_STEP_STATS
+	const auto busyStart = std::chrono::steady_clock::now();
+#endif
+
+	for (int task = 0; task < taskCount; task++)
+	{
+		job(task);
+	}
+
+#ifdef CA_STEP_STATS
+	m_InlineBusyNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - busyStart).count(),
+		std::memory_order_relaxed);
+#endif
+}
+
+void WorkStealingScheduler::TakeThreadTimes([[maybe_unused]] StepStats& stats)
+{
+	if constexpr (StepStats::Enabled)
+	{
+		// The times of the workers are updated at the end of every batch
+		std::lock_guard runLk(m_RunMutex);
+		stats.Threads.resize(std::max(stats.Threads.size(), static_cast<size_t>(m_ThreadCount)));
+		for (int i = 0; i < m_ThreadCount; i++)
+		{
+			stats.Threads[i].BusyNanoseconds += m_Workers[i].Times.BusyNanoseconds;
+			stats.Threads[i].WaitNanoseconds += m_Workers[i].Times.WaitNanoseconds;
+			m_Workers[i].Times = {};
+		}
+		stats.Threads[0].BusyNanoseconds += m_InlineBusyNanoseconds.exchange(0, std::memory_order_relaxed);
+	}
+}
+
+void WorkStealingScheduler::WorkerLoop(int workerIdx)
+{
+	// Not the current value, the first batch may already have been started
+	uint32_t batch = 0;
+
+	while (true)
+	{
+		batch = WaitWhileEqual(m_Batch, batch, m_SleepingWorkers);
+		if (m_Stop.load(std::memory_order_relaxed))
+			break;
+
+		// Threads past the count of the batch sit it out, they are not waited for
+		const int workerCount = static_cast<int>(batch & ThreadCountMask);
+		if (workerIdx >= workerCount)
+			continue;
+
+		RunTasks(workerIdx, workerCount);
+
+		if (m_BusyWorkers.fetch_sub(1) == 1 && m_SleepingCallers.load() > 0)
+			m_BusyWorkers.notify_one();
+	}
+}
+
+void WorkStealingScheduler::RunTasks(int workerIdx, int workerCount)
+{
+#ifdef CA_STEP_STATS
+	const auto busyStart = std::chrono::steady_clock::now();
+#endif
+
+	const Job& job = *m_pJob;
+	int task;
+	while (PopTask(workerIdx, task) || StealTask(workerIdx, workerCount, task))
+	{
+		job(task);
+	}
+
+#ifdef CA_STEP_STATS
+	m_Workers[workerIdx].BatchBusyNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - busyStart).count();
+#endif
+}
+
+bool WorkStealingScheduler::PopTask(int workerIdx, int& task)
+{
+	std::atomic<uint64_t>& tasks = m_Workers[workerIdx].Tasks;
+
+	uint64_t range = tasks.load();
+	while (true)
+	{
+		const uint32_t begin = static_cast<uint32_t>(range);
+		const uint32_t end = static_cast<uint32_t>(range >> 32);
+		if (begin >= end)
+			return false;
+
+		if (tasks.compare_exchange_weak(range, PackRange(begin + 1, end)))
+		{
+			task = static_cast<int>(begin);
+			return true;
+		}
+	}
+}
+
+bool WorkStealingScheduler::StealTask(int thiefIdx, int workerCount, int& task)
+{
+	for (int offset = 1; offset < workerCount; offset++)
+	{
+		std::atomic<uint64_t>& tasks = m_Workers[(thiefIdx + offset) % workerCount].Tasks;
+
+		uint64_t range = tasks.load();
+		while (true)
+		{
+			const uint32_t begin = static_cast<uint32_t>(range);
+			const uint32_t end = static_cast<uint32_t>(range >> 32);
+			if (begin >= end)
+				break;
+
+			if (tasks.compare_exchange_weak(range, PackRange(begin, end - 1)))
+			{
+				task = static_cast<int>(end - 1);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+uint64_t WorkStealingScheduler::PackRange(uint32_t begin, uint32_t end)
+{
+	return static_cast<uint64_t>(end) << 32 | begin;
+}
+
+template<typename T>
+T WorkStealingScheduler::WaitWhileEqual(const std::atomic<T>& atomic, T value, std::atomic<int>& sleepers) const
+{
+	for (int i = 0; i < m_SpinCount; i++)
+	{
+		const T current = atomic.load(std::memory_order_acquire);
+		if (current != value)
+			return current;
+		CpuRelax();
+	}
+
+	// The notifying side checks the sleepers after changing the value, so either it sees this
+	// thread counted or wait() sees the new value
+	sleepers.fetch_add(1);
+	T current = atomic.load();
+	while (current == value)
+	{
+		atomic.wait(value);
+		current = atomic.load();
+	}
+	sleepers.fetch_sub(1);
+	return current;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "StepStats.h"
+
+// Runs batches of independent tasks on the calling thread and a fixed set of worker threads.
+// Every thread starts with a contiguous block of the tasks and takes them from the front,
+// threads that run out steal from the back of another thread's block.
+// Batches are started and finished without locks: idle workers spin for a short while on the
+// batch counter before they sleep on it, the caller spins and then sleeps on the count of busy
+// workers. Back to back batches, like the phases of a step, never touch the OS.
+// One scheduler can be shared by any number of worlds, GetShared() is the one they use by default.
+class WorkStealingScheduler
+{
+public:
+	using Job = std::function<void(int task)>;
+
+	enum class Affinity
+	{
+		// Workers run wherever the OS puts them
+		None,
+		// Worker i only runs on hardware thread i, modulo their count. Best effort, ignored where unsupported
+		PinToCores
+	};
+
+	// The thread count includes the thread calling Run(), one fewer worker thread is started
+	explicit WorkStealingScheduler(int threadCount, Affinity affinity = Affinity::None);
+	~WorkStealingScheduler();
+
+	WorkStealingScheduler(const WorkStealingScheduler& other) = delete;
+	WorkStealingScheduler(WorkStealingScheduler&& other) = delete;
+	WorkStealingScheduler& operator=(const WorkStealingScheduler& other) = delete;
+	WorkStealingScheduler& operator=(WorkStealingScheduler&& other) = delete;
+
+	// The process wide scheduler, created with a thread for every hardware thread on first use
+	[[nodiscard]] static std::shared_ptr<WorkStealingScheduler> GetShared();
+	// Replaces the process wide scheduler for the worlds created after, e.g. with pinned workers
+	static void SetShared(std::shared_ptr<WorkStealingScheduler> pScheduler);
+
+	[[nodiscard]] int GetThreadCount() const;
+
+	// Calls job for every task in [0, taskCount) on at most maxThreads threads, all of them if 0,
+	// and returns when all tasks are done. The calling thread is one of them. Batches on a single
+	// thread run right away on the calling thread, batches on more threads run from different
+	// threads take turns.
+	void Run(int taskCount, const Job& job, int maxThreads = 0);
+
+	// Adds the busy and wait time of every thread since the last call to the stats, the calling thread first.
+	// When the scheduler is shared, that includes the batches of every world using it.
+	void TakeThreadTimes(StepStats& stats);
+
+private:
+	struct alignas(64) Worker
+	{
+		// Remaining tasks, first task in the low half, one past the last task in the high half
+		std::atomic<uint64_t> Tasks = 0;
+
+		// Only touched by the worker during a batch and by Run() between batches
+		long long BatchBusyNanoseconds = 0;
+		StepStats::Thread Times;
+	};
+
+	// Pause instructions spun before sleeping, a few to some tens of microseconds depending on the CPU
+	static constexpr int MaxSpinCount = 1024;
+	// Batch counter in the high bits, threads taking part in the batch in the low bits
+	static constexpr int BatchShift = 16;
+	static constexpr uint32_t ThreadCountMask = (1u << BatchShift) - 1;
+
+	void WorkerLoop(int workerIdx);
+	// Runs tasks until there are none left to take or steal
+	void RunTasks(int workerIdx, int workerCount);
+	// A batch of one thread, it doesn't touch the workers
+	void RunInline(int taskCount, const Job& job);
+	bool PopTask(int workerIdx, int& task);
+	bool StealTask(int thiefIdx, int workerCount, int& task);
+
+	static uint64_t PackRange(uint32_t begin, uint32_t end);
+	// Returns the value of the atomic once it is no longer value
+	template<typename T>
+	T WaitWhileEqual(const std::atomic<T>& atomic, T value, std::atomic<int>& sleepers) const;
+
+	// Slot 0 is the thread calling Run(), the others are the worker threads
+	int m_ThreadCount;
+	// No spinning with more threads than hardware threads, the thread being waited for may need the core
+	int m_SpinCount;
+	std::unique_ptr<Worker[]> m_Workers;
+	std::vector<std::thread> m_Threads;
+
+	// Held for a whole batch on the workers, so worlds sharing the scheduler take turns
+	std::mutex m_RunMutex;
+	// Busy time of the batches run by RunInline(), added to the calling thread's
+	std::atomic<long long> m_InlineBusyNanoseconds = 0;
+
+	const Job* m_pJob = nullptr;
+	alignas(64) std::atomic<uint32_t> m_Batch = 0;
+	std::atomic<int> m_SleepingWorkers = 0;
+	alignas(64) std::atomic<int> m_BusyWorkers = 0;
+	std::atomic<int> m_SleepingCallers = 0;
+	std::atomic<bool> m_Stop = false;
+};
@@ -1 +1,79 @@
-#include "World.h"
\ No newline at end of file
+#include "World.h"
+#include <utility>
+
+std::vector<std::vector<float>> World::GetWaterPressures() const
+{
+	const PressureView view = GetPressureView();
+
+	std::vector<std::vector<float>> pressures(view.GetWidth(), std::vector<float>(view.GetHeight(), 0));
+	for (int x = 0; x < view.GetWidth(); ++x)
+	{
+		for (int y = 0; y < view.GetHeight(); ++y)
+		{
+			pressures[x][y] = view(x, y);
+		}
+	}
+	return pressures;
+}
+
+std::vector<std::vector<bool>> World::GetBoundaries() const
+{
+	const BoundaryView view = GetBoundaryView();
+
+	std::vector<std::vector<bool>> boundaries(view.GetWidth(), std::vector<bool>(view.GetHeight(), false));
+	for (int x = 0; x < view.GetWidth(); ++x)
+	{
+		for (int y = 0; y < view.GetHeight(); ++y)
+		{
+			boundaries[x][y] = view(x, y);
+		}
+	}
+	return boundaries;
+}
+
+void World::Update(int steps)
+{
+	// Every Update() starts its stats over, so they are added up aside
+	StepStats stats;
+	for (int i = 0; i < steps; i++)
+	{
+		Update();
+		stats.Add(m_StepStats);
+	}
+	m_StepStats = std::move(stats);
+}
+
+const StepStats& World::GetStepStats() const
+{
+	return m_StepStats;
+}
+
+void World::SetSeed(uint32_t seed)
+{
+	m_Seed = seed;
+}
+
+uint32_t World::GetSeed() const
+{
+	return m_Seed;
+}
+
+void World::FillWater(const glm::ivec2& min, const glm::ivec2& max, bool water)
+{
+	SetWaterRegion(Region::Rectangle(min, max, GetSize()), water);
+}
+
+void World::FillBoundary(const glm::ivec2& min, const glm::ivec2& max, bool boundary)
+{
+	SetBoundaryRegion(Region::Rectangle(min, max, GetSize()), boundary);
+}
+
+void World::StampWater(const glm::ivec2& center, int radius, bool water)
+{
+	SetWaterRegion(Region::Circle(center, radius, GetSize()), water);
+}
+
+void World::StampBoundary(const glm::ivec2& center, int radius, bool boundary)
+{
+	SetBoundaryRegion(Region::Circle(center, radius, GetSize()), boundary);
+}
\ No newline at end of file
@@ -1,7 +1,15 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "GridView.h"
+#include "Region.h"
+#include "StepStats.h"
+
+class SnapshotWriter;
+class SnapshotReader;
+
 class World
 {
 public:
@@ -16,10 +24,51 @@ public:
 	[[nodiscard]] virtual glm::ivec2 GetSize() const = 0;
 
 	virtual void SetWater(const glm::ivec2& position, bool water) = 0;
-	[[nodiscard]] virtual std::vector<std::vector<float>> GetWaterPressures() const = 0;
+	// Live view of the water pressures, valid until the next Update()
+	[[nodiscard]] virtual PressureView GetPressureView() const = 0;
+	// Copy of the water pressures, prefer GetPressureView() in per frame code
+	[[nodiscard]] std::vector<std::vector<float>> GetWaterPressures() const;
 
 	virtual void SetBoundary(const glm::ivec2& position, bool boundary) = 0;
-	[[nodiscard]] virtual std::vector<std::vector<bool>> GetBoundaries() const = 0;
+	// Live view of the boundaries, valid until the next Update()
+	[[nodiscard]] virtual BoundaryView GetBoundaryView() const = 0;
+	// Copy of the boundaries, prefer GetBoundaryView() in per frame code
+	[[nodiscard]] std::vector<std::vector<bool>> GetBoundaries() const;
+
+	// Bulk edits, every world applies them in one pass over its storage. Each cell ends up the
+	// same as after SetWater() or SetBoundary(), cells outside the world are ignored.
+	virtual void SetWaterRegion(const Region& region, bool water) = 0;
+	virtual void SetBoundaryRegion(const Region& region, bool boundary) = 0;
+	void FillWater(const glm::ivec2& min, const glm::ivec2& max, bool water);
+	void FillBoundary(const glm::ivec2& min, const glm::ivec2& max, bool boundary);
+	void StampWater(const glm::ivec2& center, int radius, bool water);
+	void StampBoundary(const glm::ivec2& center, int radius, bool boundary);
+
+	// Replace the water or the boundaries of the cells the view covers, the view starts at (0, 0).
+	// Loaded water removes boundaries and starts at rest, loaded boundaries remove water where
+	// SetBoundary() would.
+	virtual void LoadPressures(const PressureView& pressures) = 0;
+	virtual void LoadBoundaries(const BitmaskView& boundaries) = 0;
 
 	virtual void Update() = 0;
-};
+	// Same as calling Update() steps times, worlds that can do several steps in one pass override it
+	virtual void Update(int steps);
+	// Where the time of the last Update() or Update(steps) went, all of its steps added up. Empty
+	// unless built with CA_STEP_STATS.
+	[[nodiscard]] const StepStats& GetStepStats() const;
+
+	// Every random choice is a hash of the seed, the step and the cell, so the same seed and
+	// edits always give the same result
+	void SetSeed(uint32_t seed);
+	[[nodiscard]] uint32_t GetSeed() const;
+
+	// Everything the next steps depend on, see SaveSnapshot() and LoadSnapshot(). A restored
+	// world steps exactly like the one that was saved. Reading fails without changing anything
+	// when the snapshot is of another world type or doesn't hold everything the world needs.
+	virtual void WriteSnapshot(SnapshotWriter& writer) const = 0;
+	[[nodiscard]] virtual bool ReadSnapshot(SnapshotReader& reader) = 0;
+
+protected:
+	StepStats m_StepStats;
+	uint32_t m_Seed = 0;
+};
\ No newline at end of file
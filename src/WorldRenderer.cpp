@@ -0,0 +1,125 @@
+#include "WorldRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+
+WorldRenderer::WorldRenderer(SDL_Renderer* pRenderer, const glm::ivec2& outputSize)
+	: m_pRenderer(pRenderer)
+	, m_OutputSize(outputSize)
+{
+	m_pTexture = SDL_CreateTexture(m_pRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, outputSize.x, outputSize.y);
+	m_pFormat = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB8888);
+
+	// Deeper water is darker
+	for (int i = 0; i < ColorCount; ++i)
+	{
+		const float pressure = (i + 0.5f) * MaxColorPressure / ColorCount;
+		const Uint8 shade = static_cast<Uint8>(255 / (pressure + 1));
+		m_Colors[i] = SDL_MapRGBA(m_pFormat, shade, shade, 255, 255);
+	}
+	m_EmptyColor = SDL_MapRGBA(m_pFormat, 255, 255, 255, 255);
+	m_SurfaceColor = SDL_MapRGBA(m_pFormat, 255 / 2, 255 / 2, 255, 255);
+	m_BoundaryColor = SDL_MapRGBA(m_pFormat, 0, 0, 0, 255);
+}
+
+WorldRenderer::~WorldRenderer()
+{
+	if (m_pTexture)
+		SDL_DestroyTexture(m_pTexture);
+	if (m_pFormat)
+		SDL_FreeFormat(m_pFormat);
+}
+
+SDL_Renderer* WorldRenderer::CreateRenderer(SDL_Window* pWindow)
+{
+	SDL_Renderer* pRenderer = SDL_CreateRenderer(pWindow, -1, SDL_RENDERER_ACCELERATED);
+	if (!pRenderer)
+		pRenderer = SDL_CreateRenderer(pWindow, -1, SDL_RENDERER_SOFTWARE);
+	return pRenderer;
+}
+
+void WorldRenderer::Render(const World& world)
+{
+	Render(world.GetPressureView(), world.GetBoundaryView());
+}
+
+void WorldRenderer::Render(const PressureView& pressures, const BoundaryView& boundaries)
+{
+	const glm::ivec2 worldSize = glm::min(pressures.GetSize(), boundaries.GetSize());
+	if (!m_pTexture || worldSize.x <= 0 || worldSize.y <= 0)
+		return;
+
+	if (worldSize != m_WorldSize)
+		ResizeCells(worldSize);
+
+	// Colour every cell, reading the planes in their own column order
+	for (int x = 0; x < m_WorldSize.x; ++x)
+	{
+		for (int y = 0; y < m_WorldSize.y; ++y)
+		{
+			Cell& cell = m_Cells[static_cast<size_t>(y) * m_WorldSize.x + x];
+			const float pressure = pressures(x, y);
+
+			if (boundaries(x, y))
+				cell = { m_BoundaryColor, 1 };
+			else if (pressure < 0.001f)
+				cell = { m_EmptyColor, 0 };
+			else if (pressure > 1 || (y + 1 < m_WorldSize.y && pressures(x, y + 1) >= 0.001f))
+				cell = { MapPressure(pressure), 1 };
+			else
+				cell = { m_SurfaceColor, pressure };
+		}
+	}
+
+	void* pPixels;
+	int pitch;
+	if (SDL_LockTexture(m_pTexture, nullptr, &pPixels, &pitch) != 0)
+		return;
+
+	for (int row = 0; row < m_OutputSize.y; ++row)
+	{
+		uint32_t* pRow = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pPixels) + static_cast<ptrdiff_t>(row) * pitch);
+		const Cell* pCells = m_Cells.data() + static_cast<size_t>(m_RowCells[row]) * m_WorldSize.x;
+		const float height = m_RowHeights[row];
+
+		for (int column = 0; column < m_OutputSize.x; ++column)
+		{
+			const Cell& cell = pCells[m_ColumnCells[column]];
+			pRow[column] = height < cell.Fill ? cell.Color : m_EmptyColor;
+		}
+	}
+
+	SDL_UnlockTexture(m_pTexture);
+	SDL_RenderCopy(m_pRenderer, m_pTexture, nullptr, nullptr);
+}
+
+void WorldRenderer::ResizeCells(const glm::ivec2& worldSize)
+{
+	m_WorldSize = worldSize;
+	m_Cells.assign(static_cast<size_t>(worldSize.x) * worldSize.y, { m_EmptyColor, 0 });
+
+	const float cellWidth = static_cast<float>(m_OutputSize.x) / worldSize.x;
+	const float cellHeight = static_cast<float>(m_OutputSize.y) / worldSize.y;
+
+	m_ColumnCells.resize(m_OutputSize.x);
+	for (int column = 0; column < m_OutputSize.x; ++column)
+	{
+		m_ColumnCells[column] = std::clamp(static_cast<int>((column + 0.5f) / cellWidth), 0, worldSize.x - 1);
+	}
+
+	// The texture starts at the top, y starts at the bottom
+	m_RowCells.resize(m_OutputSize.y);
+	m_RowHeights.resize(m_OutputSize.y);
+	for (int row = 0; row < m_OutputSize.y; ++row)
+	{
+		const float y = (m_OutputSize.y - (row + 0.5f)) / cellHeight;
+		m_RowCells[row] = std::clamp(static_cast<int>(y), 0, worldSize.y - 1);
+		m_RowHeights[row] = y - m_RowCells[row];
+	}
+}
+
+uint32_t WorldRenderer::MapPressure(float pressure) const
+{
+	const int index = static_cast<int>(pressure * (ColorCount / MaxColorPressure));
+	return m_Colors[std::min(index, ColorCount - 1)];
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <SDL.h>
+#include <glm/glm.hpp>
+
+#include "World.h"
+
+// Draws a world into a streaming texture the size of the output and presents it with one copy.
+// Every cell is first turned into a colour and a fill height, looked up in a precomputed colour
+// table, then every pixel picks the cell it falls in. Surface cells are drawn as high as they
+// are full, like the rectangles this replaces. Works with the software renderer as well.
+class WorldRenderer
+{
+public:
+	WorldRenderer(SDL_Renderer* pRenderer, const glm::ivec2& outputSize);
+	~WorldRenderer();
+
+	WorldRenderer(const WorldRenderer& other) = delete;
+	WorldRenderer(WorldRenderer&& other) = delete;
+	WorldRenderer& operator=(const WorldRenderer& other) = delete;
+	WorldRenderer& operator=(WorldRenderer&& other) = delete;
+
+	// Accelerated when there is one, the software renderer otherwise, e.g. with the dummy video driver
+	[[nodiscard]] static SDL_Renderer* CreateRenderer(SDL_Window* pWindow);
+
+	// Fills the whole output, no clear needed
+	void Render(const World& world);
+	void Render(const PressureView& pressures, const BoundaryView& boundaries);
+
+private:
+	struct Cell
+	{
+		uint32_t Color;
+		// How far up the cell is coloured, 1 is the whole cell
+		float Fill;
+	};
+
+	static constexpr int ColorCount = 1024;
+	static constexpr float MaxColorPressure = 4.f;
+
+	void ResizeCells(const glm::ivec2& worldSize);
+	[[nodiscard]] uint32_t MapPressure(float pressure) const;
+
+	SDL_Renderer* m_pRenderer;
+	SDL_Texture* m_pTexture = nullptr;
+	SDL_PixelFormat* m_pFormat = nullptr;
+	glm::ivec2 m_OutputSize;
+
+	std::array<uint32_t, ColorCount> m_Colors;
+	uint32_t m_EmptyColor;
+	uint32_t m_SurfaceColor;
+	uint32_t m_BoundaryColor;
+
+	// Cells row by row, the order the texture is written in
+	glm::ivec2 m_WorldSize{ 0, 0 };
+	std::vector<Cell> m_Cells;
+	// Cell of every pixel column and row, and how far up its cell the centre of every pixel row is
+	std::vector<int> m_ColumnCells;
+	std::vector<int> m_RowCells;
+	std::vector<float> m_RowHeights;
+};